@@ -0,0 +1,426 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Renderer that talks to the terminal with plain ANSI escape sequences instead
+// of curses. Frames are drawn into an off-screen canvas and only the cells that
+// differ from what the terminal already shows are sent, each run of changed
+// cells with a single cursor-addressing sequence.
+
+#include "render.h"
+
+#include "board.h"
+#include "main.h"
+#include "sudoku.h"
+#include "util.h"
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define ANSI_ROWS 64
+#define ANSI_COLS 160
+#define ANSI_OUT_SZ 65536
+// How long to wait for the rest of an escape sequence after ESC
+#define ANSI_ESC_TIMEOUT_MS 25
+
+struct AnsiCell {
+    char ch;
+    unsigned char color;
+};
+
+static struct {
+    bool have_termios;
+    struct termios saved;
+    int rows;
+    int cols;
+    // What the terminal currently shows and the frame that is being drawn
+    struct AnsiCell front[ANSI_ROWS][ANSI_COLS];
+    struct AnsiCell back[ANSI_ROWS][ANSI_COLS];
+    // Cached border for normal and small mode, built on first use and again
+    // when the variant changes
+    bool border_built[2];
+    enum SudokuVariant border_variant[2];
+    struct AnsiCell border[2][ANSI_ROWS][ANSI_COLS];
+    char out[ANSI_OUT_SZ];
+    size_t out_len;
+} ansi;
+
+// SGR sequences for the color pairs of the ncurses backend
+static const char *ansi_colors[] = {
+    "\x1b[0m",
+    "\x1b[37;40m",
+    "\x1b[34;40m",
+    "\x1b[33;40m",
+    "\x1b[30;47m",
+    "\x1b[30;44m",
+    "\x1b[31;40m",
+};
+
+static void ansi_flush(void)
+{
+    size_t written = 0;
+    while (written < ansi.out_len) {
+        ssize_t ret = write(STDOUT_FILENO, ansi.out + written, ansi.out_len - written);
+        if (ret <= 0)
+            break;
+        written += ret;
+    }
+    ansi.out_len = 0;
+}
+
+static void ansi_emit(const char *str, size_t len)
+{
+    if (ansi.out_len + len > sizeof(ansi.out))
+        ansi_flush();
+    memcpy(ansi.out + ansi.out_len, str, len);
+    ansi.out_len += len;
+}
+
+static void ansi_emit_str(const char *str)
+{
+    ansi_emit(str, strlen(str));
+}
+
+static void ansi_emit_move(int y, int x)
+{
+    char seq[32];
+    int len = snprintf(seq, sizeof(seq), "\x1b[%d;%dH", y + 1, x + 1);
+    ansi_emit(seq, len);
+}
+
+static void ansi_put(struct AnsiCell canvas[ANSI_ROWS][ANSI_COLS], int y, int x, char ch, int color)
+{
+    if (y < 0 || y >= ansi.rows || x < 0 || x >= ansi.cols)
+        return;
+    canvas[y][x] = (struct AnsiCell){ ch, color };
+}
+
+static void ansi_put_str(struct AnsiCell canvas[ANSI_ROWS][ANSI_COLS], int y, int x, const char *str, size_t len, int color)
+{
+    int col = x;
+    for (size_t i = 0; i < len && str[i] != '\0'; i++) {
+        if (str[i] == '\n') {
+            y++;
+            col = x;
+            continue;
+        }
+        ansi_put(canvas, y, col++, str[i], color);
+    }
+}
+
+static void ansi_clear(struct AnsiCell canvas[ANSI_ROWS][ANSI_COLS])
+{
+    for (int y = 0; y < ANSI_ROWS; y++)
+        for (int x = 0; x < ANSI_COLS; x++)
+            canvas[y][x] = (struct AnsiCell){ ' ', 0 };
+}
+
+// Send the difference between the back and the front canvas to the terminal
+static void ansi_present(void)
+{
+    int color = -1;
+    int cur_y = -1, cur_x = -1;
+
+    for (int y = 0; y < ansi.rows; y++) {
+        for (int x = 0; x < ansi.cols; x++) {
+            struct AnsiCell *back = &ansi.back[y][x];
+            struct AnsiCell *front = &ansi.front[y][x];
+            if (back->ch == front->ch && back->color == front->color)
+                continue;
+
+            if (cur_y != y || cur_x != x)
+                ansi_emit_move(y, x);
+            if (back->color != color) {
+                color = back->color;
+                ansi_emit_str(ansi_colors[color]);
+            }
+            ansi_emit(&back->ch, 1);
+
+            *front = *back;
+            cur_y = y;
+            cur_x = x + 1;
+        }
+    }
+
+    if (color > 0)
+        ansi_emit_str(ansi_colors[0]);
+}
+
+// Same layout as the border of the ncurses backend
+static void ansi_build_border(struct AnsiCell canvas[ANSI_ROWS][ANSI_COLS], enum SudokuVariant variant, bool small_mode)
+{
+    ansi_clear(canvas);
+
+    for (int i = 0; i < SUDOKU_LEN; i++) {
+        char marker = cell_marker(variant, i, small_mode);
+        if (marker != 0)
+            ansi_put(canvas, CELL_ROW(i / LINE_LEN, small_mode), CELL_COL(i % LINE_LEN, small_mode), marker, 3);
+    }
+
+    if (!small_mode) {
+        for (int y = 0; y < BORDER_LEN; y++) {
+            for (int x = 0; x < BORDER_LEN; x++) {
+                int color;
+                char c = border_char(variant, y, x, &color);
+                if (c != 0)
+                    ansi_put(canvas, y + PUZZLE_OFFSET, x + PUZZLE_OFFSET, c, color);
+            }
+        }
+        for (int i = 0; i < LINE_LEN; i++) {
+            ansi_put(canvas, i * 4 + PUZZLE_OFFSET + 2, 0, '1' + i, 3);
+            ansi_put(canvas, 0, i * 4 + PUZZLE_OFFSET + 2, '1' + i, 3);
+        }
+    } else {
+        for (int x = 0; x < 4; x++) {
+            for (int i = 0; i < LINE_LEN + 4; i++)
+                ansi_put(canvas, i + PUZZLE_OFFSET, x * 4 + PUZZLE_OFFSET, '|', 0);
+        }
+        for (int y = 0; y < 4; y++) {
+            for (int i = 0; i < LINE_LEN + 4; i++)
+                ansi_put(canvas, y * 4 + PUZZLE_OFFSET, i + PUZZLE_OFFSET, '-', 0);
+        }
+        for (int i = 0; i < LINE_LEN; i++) {
+            ansi_put(canvas, CELL_ROW(i, true), 0, '1' + i, 3);
+            ansi_put(canvas, 0, CELL_COL(i, true), '1' + i, 3);
+        }
+    }
+}
+
+static void ansi_draw_border(enum SudokuVariant variant, bool small_mode)
+{
+    if (!ansi.border_built[small_mode] || ansi.border_variant[small_mode] != variant) {
+        ansi_build_border(ansi.border[small_mode], variant, small_mode);
+        ansi.border_built[small_mode] = true;
+        ansi.border_variant[small_mode] = variant;
+    }
+
+    memcpy(ansi.back, ansi.border[small_mode], sizeof(ansi.back));
+}
+
+static void ansi_read_sudoku(const struct TSStruct *spec, const char *sudoku, int color_mode, int color_mode_highlight)
+{
+    bool small_mode = spec->opts->small_mode;
+
+    for (int y = 0; y < LINE_LEN; y++) {
+        for (int x = 0; x < LINE_LEN; x++) {
+            char current_digit = sudoku[y * LINE_LEN + x];
+            if (current_digit == '0')
+                continue;
+
+            int color = current_digit == spec->highlight ? color_mode_highlight : color_mode;
+            if (spec->check.impossible[y * LINE_LEN + x])
+                color = 6;
+            ansi_put(ansi.back, CELL_ROW(y, small_mode), CELL_COL(x, small_mode), current_digit, color);
+        }
+    }
+}
+
+static void ansi_read_notes(const struct SudokuSpec *spec)
+{
+    for (int i = 0; i < SUDOKU_LEN; i++) {
+        for (int j = 0; j < LINE_LEN; j++) {
+            if (spec->notes[i] & BOARD_NOTE(j + 1))
+                ansi_put(ansi.back, CELL_ROW(i / LINE_LEN, false) - 1 + (j / 3),
+                         CELL_COL(i % LINE_LEN, false) - 1 + (j % 3), '1' + j, 3);
+        }
+    }
+}
+
+static void ansi_move_cursor(const struct Cursor *curs, bool small_mode)
+{
+    ansi_emit_move(CELL_ROW(curs->y, small_mode), CELL_COL(curs->x, small_mode));
+    ansi_flush();
+}
+
+// A size of the screen from the environment, 'fallback' if it is not set
+static int env_size(const char *name, int fallback, int max)
+{
+    const char *value = getenv(name);
+    int size = value != NULL ? atoi(value) : 0;
+    if (size <= 0)
+        return fallback;
+    return size < max ? size : max;
+}
+
+static void ansi_init(void)
+{
+    if (tcgetattr(STDIN_FILENO, &ansi.saved) == 0) {
+        struct termios raw = ansi.saved;
+        // Like cbreak(), noecho() and nonl() of the ncurses backend
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_iflag &= ~(ICRNL | IXON);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+        ansi.have_termios = true;
+    }
+
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+        ansi.rows = ws.ws_row < ANSI_ROWS ? ws.ws_row : ANSI_ROWS;
+        ansi.cols = ws.ws_col < ANSI_COLS ? ws.ws_col : ANSI_COLS;
+    } else {
+        // Not a terminal (like the replay of '-k'): LINES and COLUMNS, as for
+        // ncurses
+        ansi.rows = env_size("LINES", 24, ANSI_ROWS);
+        ansi.cols = env_size("COLUMNS", 80, ANSI_COLS);
+    }
+
+    ansi_clear(ansi.front);
+    // Alternate screen, cleared
+    ansi_emit_str("\x1b[?1049h\x1b[0m\x1b[2J");
+    ansi_flush();
+}
+
+static void ansi_finish(void)
+{
+    ansi_emit_str("\x1b[0m\x1b[?25h\x1b[?1049l");
+    ansi_flush();
+
+    if (ansi.have_termios)
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &ansi.saved);
+}
+
+static void ansi_draw(const struct TSStruct *spec)
+{
+    bool small_mode = spec->opts->small_mode;
+
+    ansi_draw_border(spec->sudoku->variant, small_mode);
+    if (!small_mode)
+        ansi_read_notes(spec->sudoku);
+    char sudoku[SUDOKU_LEN];
+    board_numbers_text(spec->sudoku, sudoku);
+    ansi_read_sudoku(spec, sudoku, 2, 5);
+    board_clues_text(spec->sudoku, sudoku);
+    ansi_read_sudoku(spec, sudoku, 1, 4);
+
+    int string_y = small_mode ? LINE_LEN + 5 + PUZZLE_OFFSET : PUZZLE_OFFSET;
+    int string_x = small_mode ? 0 : (LINE_LEN * 4) + 3 + PUZZLE_OFFSET;
+
+    ansi_put_str(ansi.back, string_y, string_x, spec->statusbar, STR_LEN, 1);
+    ansi_put_str(ansi.back, string_y + 1, string_x, spec->debugline, STR_LEN, 1);
+    string_y += 2;
+
+    if (!small_mode) {
+        ansi_put_str(ansi.back, string_y, string_x, spec->controls, strlen(spec->controls), 1);
+        for (const char *c = spec->controls; *c; c++)
+            string_y += *c == '\n';
+
+        char mode[STR_LEN];
+        int len = snprintf(mode, sizeof(mode), "--- %s ---", spec->editing_notes ? "Note" : "Normal");
+        if (spec->sudoku->variant != SUDOKU_VARIANT_STANDARD)
+            snprintf(mode + len, sizeof(mode) - len, " %s", sudoku_variant_name(spec->sudoku->variant));
+        ansi_put_str(ansi.back, string_y + 1, string_x, mode, sizeof(mode), 1);
+    } else {
+        ansi_put_str(ansi.back, string_y, string_x, spec->controls, strlen(spec->controls), 1);
+    }
+
+    ansi_present();
+    ansi_move_cursor(spec->cursor, small_mode);
+}
+
+static void ansi_draw_visual(const struct TSStruct *spec, const char *sudoku_to_display)
+{
+    ansi_draw_border(spec->sudoku->variant, spec->opts->small_mode);
+    ansi_read_sudoku(spec, sudoku_to_display, 1, 4);
+    ansi_present();
+    ansi_flush();
+}
+
+static void ansi_draw_fileview(const char *controls, const char *dir, char **items, int count, int position)
+{
+    const int filestart = 4;
+
+    ansi_clear(ansi.back);
+    ansi_put_str(ansi.back, 0, 0, controls, strlen(controls), 0);
+    ansi_put_str(ansi.back, 2, 0, dir, strlen(dir), 0);
+    for (int j = 0; j < count; j++)
+        ansi_put_str(ansi.back, j + filestart, 6, items[j], strlen(items[j]), 0);
+    ansi_put(ansi.back, position + filestart, 4, '*', 0);
+
+    ansi_present();
+    ansi_flush();
+}
+
+static void ansi_show_cursor(bool visible)
+{
+    ansi_emit_str(visible ? "\x1b[?25h" : "\x1b[?25l");
+    ansi_flush();
+}
+
+static bool ansi_wait_input(int timeout_ms)
+{
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+static int ansi_get_key(void)
+{
+    unsigned char c;
+    if (read(STDIN_FILENO, &c, 1) != 1)
+        finish(0);
+
+    if (c != '\x1b' || !ansi_wait_input(ANSI_ESC_TIMEOUT_MS))
+        return c;
+
+    // Arrow keys: ESC [ A-D or ESC O A-D
+    unsigned char seq[2];
+    if (read(STDIN_FILENO, &seq[0], 1) != 1 || (seq[0] != '[' && seq[0] != 'O'))
+        return c;
+    if (!ansi_wait_input(ANSI_ESC_TIMEOUT_MS) || read(STDIN_FILENO, &seq[1], 1) != 1)
+        return c;
+
+    switch (seq[1]) {
+    case 'A':
+        return TS_KEY_UP;
+    case 'B':
+        return TS_KEY_DOWN;
+    case 'C':
+        return TS_KEY_RIGHT;
+    case 'D':
+        return TS_KEY_LEFT;
+    default:
+        return c;
+    }
+}
+
+static int ansi_poll_key(void)
+{
+    if (!ansi_wait_input(0))
+        return TS_KEY_NONE;
+
+    return ansi_get_key();
+}
+
+const struct Renderer ansi_renderer = {
+    .name = "ansi",
+    .init = ansi_init,
+    .finish = ansi_finish,
+    .draw = ansi_draw,
+    .draw_fileview = ansi_draw_fileview,
+    .draw_visual = ansi_draw_visual,
+    .move_cursor = ansi_move_cursor,
+    .show_cursor = ansi_show_cursor,
+    .get_key = ansi_get_key,
+    .poll_key = ansi_poll_key,
+};
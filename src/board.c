@@ -0,0 +1,164 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "board.h"
+
+#include "sudoku.h"
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// Longest variant name with its terminator
+#define STR_VARIANT_LEN 16
+
+int text_digit(char c);
+
+// Digit of a character of a grid in text form, 0 for anything but '1'-'9'
+int text_digit(char c)
+{
+    return c >= '1' && c <= '9' ? CHNUM(c) : 0;
+}
+
+void board_clear(struct SudokuSpec *board)
+{
+    memset(board, 0, sizeof(*board));
+}
+
+// Make 'digit' a clue of the puzzle, 0 removes the clue
+void board_set_clue(struct SudokuSpec *board, int cell, int digit)
+{
+    board->digits[cell] = digit;
+    if (digit != 0)
+        board->given[cell / 8] |= 1u << (cell % 8);
+    else
+        board->given[cell / 8] &= ~(1u << (cell % 8));
+}
+
+// Take the digits of a grid as the clues of the puzzle, cells empty in the grid
+// are no clues any more
+void board_set_clues(struct SudokuSpec *board, const char *sudoku)
+{
+    for (int i = 0; i < SUDOKU_LEN; i++) {
+        int digit = text_digit(sudoku[i]);
+        if (digit != 0 || BOARD_IS_GIVEN(board, i))
+            board_set_clue(board, i, digit);
+    }
+}
+
+// Take the digits of a grid as the numbers of the user, clues are kept
+void board_set_numbers(struct SudokuSpec *board, const char *sudoku)
+{
+    for (int i = 0; i < SUDOKU_LEN; i++) {
+        if (!BOARD_IS_GIVEN(board, i))
+            board->digits[i] = text_digit(sudoku[i]);
+    }
+}
+
+// The clues alone as text
+void board_clues_text(const struct SudokuSpec *board, char *sudoku)
+{
+    for (int i = 0; i < SUDOKU_LEN; i++)
+        sudoku[i] = '0' + (BOARD_IS_GIVEN(board, i) ? board->digits[i] : 0);
+}
+
+// The numbers of the user alone as text
+void board_numbers_text(const struct SudokuSpec *board, char *sudoku)
+{
+    for (int i = 0; i < SUDOKU_LEN; i++)
+        sudoku[i] = '0' + (BOARD_IS_GIVEN(board, i) ? 0 : board->digits[i]);
+}
+
+// Clues and numbers of the user together as text
+void board_grid_text(const struct SudokuSpec *board, char *sudoku)
+{
+    for (int i = 0; i < SUDOKU_LEN; i++)
+        sudoku[i] = '0' + board->digits[i];
+}
+
+// Write the game in the format of the save files: the clues and the numbers of
+// the user as a line of SUDOKU_LEN digits each, then the notes as a line of
+// nine 0s or 1s for every cell. A variant other than the standard one follows
+// as a line "variant NAME".
+void board_write(const struct SudokuSpec *board, FILE *out)
+{
+    char line[SUDOKU_LEN * LINE_LEN];
+
+    board_clues_text(board, line);
+    fprintf(out, "%.*s\n", SUDOKU_LEN, line);
+    board_numbers_text(board, line);
+    fprintf(out, "%.*s\n", SUDOKU_LEN, line);
+
+    for (int i = 0; i < SUDOKU_LEN; i++) {
+        for (int j = 0; j < LINE_LEN; j++)
+            line[i * LINE_LEN + j] = board->notes[i] & (1u << j) ? '1' : '0';
+    }
+    fprintf(out, "%.*s\n", (int)sizeof(line), line);
+
+    if (board->variant != SUDOKU_VARIANT_STANDARD)
+        fprintf(out, "variant %s\n", sudoku_variant_name(board->variant));
+}
+
+// Read a game written by board_write(), false if the file is cut short or
+// names an unknown variant
+bool board_read(struct SudokuSpec *board, FILE *in)
+{
+    char clues[SUDOKU_LEN + 1];
+    char numbers[SUDOKU_LEN + 1];
+
+    board_clear(board);
+
+    if (fscanf(in, "%81s %81s", clues, numbers) != 2 ||
+        strlen(clues) != SUDOKU_LEN || strlen(numbers) != SUDOKU_LEN)
+        return false;
+
+    board_set_clues(board, clues);
+    board_set_numbers(board, numbers);
+
+    for (int i = 0; i < SUDOKU_LEN * LINE_LEN; i++) {
+        char note;
+        if (fscanf(in, " %c", &note) != 1)
+            return false;
+        if (note == '1')
+            board->notes[i / LINE_LEN] |= 1u << (i % LINE_LEN);
+    }
+
+    // Files of the standard grid have no variant line
+    char name[STR_VARIANT_LEN];
+    enum SudokuVariant variant = SUDOKU_VARIANT_STANDARD;
+    if (fscanf(in, " variant %15s", name) == 1 && !board_parse_variant(name, &variant))
+        return false;
+    board->variant = variant;
+
+    return true;
+}
+
+// Translate the name of a variant, as in save files and the argument of
+// '--variant'
+bool board_parse_variant(const char *name, enum SudokuVariant *variant)
+{
+    for (int i = SUDOKU_VARIANT_STANDARD; i < SUDOKU_VARIANT_COUNT; i++) {
+        if (strcmp(name, sudoku_variant_name(i)) == 0) {
+            *variant = i;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,54 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "sudoku.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define BOARD_GIVEN_LEN ((SUDOKU_LEN + 7) / 8)
+#define BOARD_NOTES_ALL ((1u << LINE_LEN) - 1)
+
+// A game in play. Digits are 1-9 (0 for an empty cell) for the clues and the
+// numbers of the user alike, the clues are marked by a bit in 'given'. The
+// notes of a cell are one bit per digit, bit 0 for a 1. Text with '0'-'9'
+// is only used for files, the screen and libsudoku. 'variant' is the enum
+// SudokuVariant whose rules the puzzle follows.
+struct SudokuSpec {
+    uint8_t digits[SUDOKU_LEN];
+    uint8_t given[BOARD_GIVEN_LEN];
+    uint16_t notes[SUDOKU_LEN];
+    uint8_t variant;
+};
+
+#define BOARD_IS_GIVEN(board, cell) (((board)->given[(cell) / 8] >> ((cell) % 8)) & 1)
+#define BOARD_NOTE(digit) ((uint16_t)(1u << ((digit) - 1)))
+
+void board_clear(struct SudokuSpec *board);
+void board_set_clue(struct SudokuSpec *board, int cell, int digit);
+void board_set_clues(struct SudokuSpec *board, const char *sudoku);
+void board_set_numbers(struct SudokuSpec *board, const char *sudoku);
+void board_clues_text(const struct SudokuSpec *board, char *sudoku);
+void board_numbers_text(const struct SudokuSpec *board, char *sudoku);
+void board_grid_text(const struct SudokuSpec *board, char *sudoku);
+void board_write(const struct SudokuSpec *board, FILE *out);
+bool board_read(struct SudokuSpec *board, FILE *in);
+bool board_parse_variant(const char *name, enum SudokuVariant *variant);
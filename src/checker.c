@@ -0,0 +1,294 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Count the solutions of the puzzle being entered on a thread of its own, so
+// typing never waits for the search. Every submitted puzzle cancels the check
+// of the one before. Most keys change a single clue, so the checker first
+// tries to carry the result of the last puzzle over: added clues that agree
+// with the only solution keep it unique, a puzzle without solution stays so
+// as long as its impossible clues stay, and removing clues never makes many
+// solutions fewer. Only then does it search, for at most CHECKER_MAX_NODES
+// nodes in all.
+
+#include "checker.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Checker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t submitted;
+    struct SudokuCtx *ctx;
+    // The puzzle submitted last and its number, 'quit' ends the thread
+    char puzzle[SUDOKU_LEN];
+    unsigned long long generation;
+    bool quit;
+    // Number of the puzzle the thread checks and of the last one it finished
+    unsigned long long working;
+    unsigned long long finished;
+    struct CheckResult result;
+    bool result_new;
+    // Nodes the searches of the current check visited, counted in steps of
+    // SUDOKU_PROGRESS_INTERVAL
+    unsigned long long nodes;
+    // The last puzzle checked to the end, with its only solution if it has
+    // one; only the thread touches these
+    bool have_known;
+    char known_puzzle[SUDOKU_LEN];
+    struct CheckResult known;
+    bool have_solution;
+    char solution[SUDOKU_LEN];
+};
+
+static bool superseded(struct Checker *checker);
+static bool keep_searching(const struct SudokuProgress *progress, void *user);
+static void publish(struct Checker *checker, const struct CheckResult *result, bool final);
+static bool clues_kept(const char *from, const char *to, const bool *cells);
+static bool narrow_impossible(struct Checker *checker, const char *puzzle, bool *impossible);
+static void check(struct Checker *checker, const char *puzzle);
+static void *check_thread(void *arg);
+
+// A newer puzzle came in, the current check is of no use anymore
+static bool superseded(struct Checker *checker)
+{
+    pthread_mutex_lock(&checker->lock);
+    bool newer = checker->working != checker->generation || checker->quit;
+    pthread_mutex_unlock(&checker->lock);
+
+    return newer;
+}
+
+static bool keep_searching(const struct SudokuProgress *progress, void *user)
+{
+    struct Checker *checker = user;
+    if (progress->nodes > 0)
+        checker->nodes += SUDOKU_PROGRESS_INTERVAL;
+
+    return checker->nodes < CHECKER_MAX_NODES && !superseded(checker);
+}
+
+// Hand a result to checker_poll(), dropped if a newer puzzle came in
+static void publish(struct Checker *checker, const struct CheckResult *result, bool final)
+{
+    pthread_mutex_lock(&checker->lock);
+    if (checker->working == checker->generation) {
+        checker->result = *result;
+        checker->result_new = true;
+        if (final)
+            checker->finished = checker->working;
+    }
+    pthread_mutex_unlock(&checker->lock);
+}
+
+// Every clue of 'from' is in 'to' as well, only looking at 'cells' if it is
+// not NULL
+static bool clues_kept(const char *from, const char *to, const bool *cells)
+{
+    for (int i = 0; i < SUDOKU_LEN; i++) {
+        if (from[i] != '0' && from[i] != to[i] && (cells == NULL || cells[i]))
+            return false;
+    }
+
+    return true;
+}
+
+// Take the clues of a puzzle without solution away one by one, keeping those
+// without which it has a solution. What remains are clues that cannot all
+// stay, none of them superfluous unless the searches ran out of nodes: then
+// the clues not tried yet stay as well. False if a newer puzzle came in.
+static bool narrow_impossible(struct Checker *checker, const char *puzzle, bool *impossible)
+{
+    char reduced[SUDOKU_LEN];
+    memcpy(reduced, puzzle, SUDOKU_LEN);
+
+    for (int i = 0; i < SUDOKU_LEN; i++) {
+        if (reduced[i] == '0')
+            continue;
+
+        reduced[i] = '0';
+        int solutions = sudoku_count_solutions(checker->ctx, reduced);
+        if (solutions < 0 && superseded(checker))
+            return false;
+        if (solutions != 0)
+            reduced[i] = puzzle[i];
+    }
+
+    for (int i = 0; i < SUDOKU_LEN; i++)
+        impossible[i] = reduced[i] != '0';
+    return true;
+}
+
+static void check(struct Checker *checker, const char *puzzle)
+{
+    struct CheckResult result = { .solutions = -1 };
+    bool have_solution = false;
+    checker->nodes = 0;
+
+    if (checker->have_known && memcmp(puzzle, checker->known_puzzle, SUDOKU_LEN) == 0) {
+        publish(checker, &checker->known, true);
+        return;
+    }
+
+    bool carried = false;
+    if (sudoku_find_conflicts(checker->ctx, puzzle, result.impossible) > 0) {
+        result.solutions = 0;
+        carried = true;
+    } else if (checker->have_known) {
+        const char *known = checker->known_puzzle;
+        if (checker->known.solutions == 0 && clues_kept(known, puzzle, checker->known.impossible)) {
+            result = checker->known;
+            carried = true;
+        } else if (checker->known.solutions == 1 && checker->have_solution && clues_kept(known, puzzle, NULL)) {
+            result.solutions = clues_kept(puzzle, checker->solution, NULL) ? 1 : 0;
+            have_solution = result.solutions == 1;
+            carried = have_solution;
+        } else if (checker->known.solutions == 2 && clues_kept(puzzle, known, NULL)) {
+            result.solutions = 2;
+            carried = true;
+        }
+    }
+
+    if (result.solutions < 0) {
+        result.solutions = sudoku_count_solutions(checker->ctx, puzzle);
+        if (result.solutions < 0 && superseded(checker))
+            return;
+
+        if (result.solutions == 1) {
+            memcpy(checker->solution, puzzle, SUDOKU_LEN);
+            have_solution = sudoku_solve(checker->ctx, checker->solution);
+            if (!have_solution && superseded(checker))
+                return;
+        }
+    }
+
+    if (result.solutions == 0 && !carried) {
+        result.narrowing = true;
+        publish(checker, &result, false);
+        if (!narrow_impossible(checker, puzzle, result.impossible))
+            return;
+        result.narrowing = false;
+    }
+
+    publish(checker, &result, true);
+
+    checker->have_known = true;
+    memcpy(checker->known_puzzle, puzzle, SUDOKU_LEN);
+    checker->known = result;
+    checker->have_solution = have_solution;
+}
+
+static void *check_thread(void *arg)
+{
+    struct Checker *checker = arg;
+    char puzzle[SUDOKU_LEN];
+
+    pthread_mutex_lock(&checker->lock);
+    for (;;) {
+        while (!checker->quit && checker->working == checker->generation)
+            pthread_cond_wait(&checker->submitted, &checker->lock);
+        if (checker->quit)
+            break;
+
+        checker->working = checker->generation;
+        memcpy(puzzle, checker->puzzle, SUDOKU_LEN);
+        pthread_mutex_unlock(&checker->lock);
+
+        check(checker, puzzle);
+
+        pthread_mutex_lock(&checker->lock);
+    }
+    pthread_mutex_unlock(&checker->lock);
+
+    return NULL;
+}
+
+// Start the thread of a checker for puzzles of 'variant', NULL on failure
+struct Checker *checker_new(enum SudokuVariant variant)
+{
+    struct Checker *checker = calloc(1, sizeof(*checker));
+    if (checker == NULL)
+        return NULL;
+
+    checker->ctx = sudoku_ctx_new();
+    if (checker->ctx == NULL) {
+        free(checker);
+        return NULL;
+    }
+    sudoku_ctx_set_variant(checker->ctx, variant);
+    sudoku_ctx_set_progress_callback(checker->ctx, keep_searching, checker);
+
+    pthread_mutex_init(&checker->lock, NULL);
+    pthread_cond_init(&checker->submitted, NULL);
+    if (pthread_create(&checker->thread, NULL, check_thread, checker) != 0) {
+        pthread_cond_destroy(&checker->submitted);
+        pthread_mutex_destroy(&checker->lock);
+        sudoku_ctx_free(checker->ctx);
+        free(checker);
+        return NULL;
+    }
+
+    return checker;
+}
+
+// Cancel the running check and stop the thread
+void checker_free(struct Checker *checker)
+{
+    if (checker == NULL)
+        return;
+
+    pthread_mutex_lock(&checker->lock);
+    checker->quit = true;
+    pthread_cond_signal(&checker->submitted);
+    pthread_mutex_unlock(&checker->lock);
+    pthread_join(checker->thread, NULL);
+
+    pthread_cond_destroy(&checker->submitted);
+    pthread_mutex_destroy(&checker->lock);
+    sudoku_ctx_free(checker->ctx);
+    free(checker);
+}
+
+// Check 'puzzle' instead of whatever is being checked
+void checker_submit(struct Checker *checker, const char *puzzle)
+{
+    pthread_mutex_lock(&checker->lock);
+    memcpy(checker->puzzle, puzzle, SUDOKU_LEN);
+    checker->generation++;
+    checker->result_new = false;
+    pthread_cond_signal(&checker->submitted);
+    pthread_mutex_unlock(&checker->lock);
+}
+
+// Take a new result of the puzzle submitted last, if there is one
+enum CheckState checker_poll(struct Checker *checker, struct CheckResult *result)
+{
+    pthread_mutex_lock(&checker->lock);
+    enum CheckState state = CHECK_IDLE;
+    if (checker->result_new) {
+        *result = checker->result;
+        checker->result_new = false;
+        state = CHECK_DONE;
+    } else if (checker->finished != checker->generation) {
+        state = CHECK_RUNNING;
+    }
+    pthread_mutex_unlock(&checker->lock);
+
+    return state;
+}
@@ -0,0 +1,51 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "sudoku.h"
+
+#include <stdbool.h>
+
+// Nodes the searches of one check may visit together before it gives up
+#define CHECKER_MAX_NODES (1ULL << 16)
+
+// What the checker found out about a puzzle
+struct CheckResult {
+    // 0, 1, 2 for more than one, -1 if the search took too long
+    int solutions;
+    // Without a solution: clues that cannot all stay. 'narrowing' while the
+    // superfluous ones are still being taken out
+    bool impossible[SUDOKU_LEN];
+    bool narrowing;
+};
+
+enum CheckState {
+    // The result of the puzzle submitted last has been taken
+    CHECK_IDLE,
+    CHECK_RUNNING,
+    // A new result was taken, more may follow
+    CHECK_DONE,
+};
+
+struct Checker;
+
+struct Checker *checker_new(enum SudokuVariant variant);
+void checker_free(struct Checker *checker);
+void checker_submit(struct Checker *checker, const char *puzzle);
+enum CheckState checker_poll(struct Checker *checker, struct CheckResult *result);
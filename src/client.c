@@ -0,0 +1,220 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// sudoku-client: send requests to a running 'term-sudoku --serve' and, with
+// '-n', put it under load and report the latency of the requests.
+
+#include "server.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+struct LoadThread {
+    pthread_t thread;
+    const char *socket_path;
+    const char *request;
+    int requests;
+    long long *latencies;
+    int failed;
+};
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static FILE *connect_server(const char *socket_path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return NULL;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    return fdopen(fd, "r+");
+}
+
+// Send a request and read the response line into 'response'
+static bool roundtrip(FILE *conn, const char *request, char *response, size_t sz)
+{
+    if (fprintf(conn, "%s\n", request) < 0 || fflush(conn) != 0)
+        return false;
+
+    if (fgets(response, sz, conn) == NULL)
+        return false;
+    response[strcspn(response, "\n")] = '\0';
+
+    return true;
+}
+
+static void *load_thread(void *arg)
+{
+    struct LoadThread *self = arg;
+    char response[SERVER_LINE_LEN];
+
+    FILE *conn = connect_server(self->socket_path);
+    if (conn == NULL) {
+        self->failed = self->requests;
+        return NULL;
+    }
+
+    for (int i = 0; i < self->requests; i++) {
+        long long start = now_ns();
+        if (!roundtrip(conn, self->request, response, sizeof(response)) ||
+            strncmp(response, "OK", 2) != 0)
+            self->failed++;
+        self->latencies[i] = now_ns() - start;
+    }
+
+    fclose(conn);
+    return NULL;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static int load_test(const char *socket_path, const char *request, int connections, int requests)
+{
+    struct LoadThread *threads = calloc(connections, sizeof(*threads));
+    long long *latencies = calloc((size_t)connections * requests, sizeof(*latencies));
+    if (threads == NULL || latencies == NULL) {
+        perror("Allocating load test");
+        return 1;
+    }
+
+    long long start = now_ns();
+    for (int i = 0; i < connections; i++) {
+        threads[i] = (struct LoadThread){
+            .socket_path = socket_path,
+            .request = request,
+            .requests = requests,
+            .latencies = latencies + (size_t)i * requests,
+        };
+        if (pthread_create(&threads[i].thread, NULL, load_thread, &threads[i]) != 0) {
+            perror("Starting load threads");
+            return 1;
+        }
+    }
+
+    int failed = 0;
+    for (int i = 0; i < connections; i++) {
+        pthread_join(threads[i].thread, NULL);
+        failed += threads[i].failed;
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    size_t total = (size_t)connections * requests;
+    qsort(latencies, total, sizeof(*latencies), cmp_ll);
+
+    printf("requests: %zu (%d failed) over %d connections in %.3f s, %.1f requests/s\n",
+           total, failed, connections, seconds, total / seconds);
+    printf("latency (us): p50 %.1f  p99 %.1f  max %.1f\n",
+           latencies[total / 2] / 1000.0, latencies[(total * 99) / 100] / 1000.0,
+           latencies[total - 1] / 1000.0);
+
+    free(latencies);
+    free(threads);
+
+    return failed > 0;
+}
+
+int main(int argc, char **argv)
+{
+    int connections = 1;
+    int requests = 0;
+
+    int flag;
+    while ((flag = getopt(argc, argv, "hc:n:")) != -1) {
+        switch (flag) {
+        case 'h':
+            printf("usage: sudoku-client [-c CONNECTIONS] [-n REQUESTS] SOCKET [REQUEST...]\n\n"
+                   "Send each REQUEST (default: GEN) to the term-sudoku service on\n"
+                   "SOCKET and print the responses.\n\n"
+                   "-n: REQUESTS: load test instead: send the first REQUEST this many\n"
+                   "    times per connection and report latency and throughput\n"
+                   "-c: CONNECTIONS: concurrent connections for the load test "
+                   "(default: 1)\n");
+            return 0;
+        case 'c':
+            connections = strtol(optarg, NULL, 10);
+            if (connections <= 0)
+                connections = 1;
+            break;
+        case 'n':
+            requests = strtol(optarg, NULL, 10);
+            break;
+        case '?':
+        default:
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "No socket given\n");
+        return 1;
+    }
+    const char *socket_path = argv[optind++];
+
+    if (requests > 0)
+        return load_test(socket_path, optind < argc ? argv[optind] : "GEN", connections, requests);
+
+    FILE *conn = connect_server(socket_path);
+    if (conn == NULL) {
+        fprintf(stderr, "Connecting to %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+
+    char response[SERVER_LINE_LEN];
+    int status = 0;
+    do {
+        const char *request = optind < argc ? argv[optind] : "GEN";
+        if (!roundtrip(conn, request, response, sizeof(response))) {
+            fprintf(stderr, "No response to '%s'\n", request);
+            status = 1;
+            break;
+        }
+        printf("%s\n", response);
+        if (strncmp(response, "OK", 2) != 0)
+            status = 1;
+    } while (++optind < argc);
+
+    fclose(conn);
+    return status;
+}
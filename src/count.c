@@ -0,0 +1,138 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Count the solutions of puzzles exactly ('--count-solutions'), one puzzle per
+// line of the files or of stdin, and report how long each count took. Lines
+// may start with the index of the puzzle and end with its grade, as the files of
+// sudoku-merge do.
+
+#include "count.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// The grade after a puzzle, as '--puzzles' writes it
+static bool is_grade(const char *text)
+{
+    int end = 0;
+    sscanf(text, "%*[a-z] %n", &end);
+    return end > 0 && text[end] == '\0';
+}
+
+// Read the puzzle on 'line', with or without an index before it and its grade
+// after it. The index goes to 'index', empty if there is none. False if it is
+// no puzzle.
+static bool parse_line(const char *line, char *puzzle, char *index, size_t index_sz)
+{
+    index[0] = '\0';
+    if (sudoku_parse(line, strlen(line), puzzle) == SUDOKU_LEN)
+        return true;
+
+    size_t index_len = strspn(line, "0123456789");
+    if (index_len == 0 || index_len >= index_sz || (line[index_len] != ' ' && line[index_len] != '\t'))
+        return false;
+    const char *rest = line + index_len;
+    // Puzzles hold no letters, the grade does
+    size_t puzzle_len = strcspn(rest, "abcdefghijklmnopqrstuvwxyz");
+    if (rest[puzzle_len] != '\0' && !is_grade(rest + puzzle_len))
+        return false;
+    if (sudoku_parse(rest, puzzle_len, puzzle) != SUDOKU_LEN)
+        return false;
+    snprintf(index, index_sz, "%.*s ", (int)index_len, line);
+    return true;
+}
+
+// Count the puzzles of one file ('-' for stdin), false if any line could not
+// be read
+static bool count_file(struct SudokuCtx *ctx, unsigned long long limit, const char *path)
+{
+    bool from_stdin = strcmp(path, "-") == 0;
+    FILE *file = from_stdin ? stdin : fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+
+    bool ok = true;
+    char line[COUNT_LINE_LEN];
+    for (int lineno = 1; fgets(line, sizeof(line), file) != NULL; lineno++) {
+        size_t len = strlen(line);
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n' && !feof(file)) {
+            fprintf(stderr, "%s:%d: line too long\n", path, lineno);
+            ok = false;
+            break;
+        }
+        size_t start = strspn(line, " \t\r\n");
+        if (line[start] == '\0' || line[start] == '#')
+            continue;
+
+        char puzzle[SUDOKU_LEN];
+        char index[24];
+        if (!parse_line(line + start, puzzle, index, sizeof(index))) {
+            fprintf(stderr, "%s:%d: not a puzzle\n", path, lineno);
+            ok = false;
+            continue;
+        }
+
+        struct SudokuCount count;
+        long long start_ns = monotonic_ns();
+        sudoku_count_exact(ctx, puzzle, limit, &count);
+        double ms = (monotonic_ns() - start_ns) / 1e6;
+
+        // A count that reached the limit is only a lower bound
+        printf("%s%.*s %llu%s solutions %.1f ms %llu nodes\n", index, SUDOKU_LEN, puzzle,
+               count.solutions, limit != 0 && count.solutions >= limit ? "+" : "", ms,
+               count.nodes);
+    }
+
+    if (ferror(file)) {
+        perror(path);
+        ok = false;
+    }
+    if (!from_stdin)
+        fclose(file);
+    return ok;
+}
+
+// Count the solutions of the puzzles in 'files', or of those on stdin if there
+// are none, up to 'opts->count_limit'. Returns the exit status.
+int count_solutions(const struct TSOpts *opts, char **files, int files_len)
+{
+    struct SudokuCtx *ctx = sudoku_ctx_new();
+    if (ctx == NULL) {
+        perror("Allocating solver");
+        return 1;
+    }
+    sudoku_ctx_set_variant(ctx, opts->variant);
+
+    bool ok = true;
+    if (files_len == 0)
+        ok = count_file(ctx, opts->count_limit, "-");
+    for (int i = 0; i < files_len; i++)
+        ok = count_file(ctx, opts->count_limit, files[i]) && ok;
+    if (opts->stats != STATS_OFF)
+        stats_print(ctx, opts->stats);
+    sudoku_ctx_free(ctx);
+
+    if (fflush(stdout) != 0) {
+        perror("Writing counts");
+        return 1;
+    }
+    return ok ? 0 : 1;
+}
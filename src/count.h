@@ -20,14 +20,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "main.h"
 
-struct Cursor {
-    int y;
-    int x;
-};
+// Longest line of a file of puzzles count_solutions() reads
+#define COUNT_LINE_LEN 512
 
-void init_ncurses(void);
-void draw(const struct TSStruct *spec);
-void move_cursor_to(struct Cursor *curs, bool small_mode, int x, int y);
-void move_cursor(struct Cursor *curs, bool small_mode);
-void init_visual_generator(struct TSStruct *spec);
-void generate_visually(const char *sudoku_to_display);
+int count_solutions(const struct TSOpts *opts, char **files, int files_len);
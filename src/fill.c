@@ -0,0 +1,50 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Write complete grids for bulk use ('--fill-grids COUNT'), one per line, made
+// by sudoku_fill() from the seed and the rules of '--variant'.
+
+#include "fill.h"
+
+#include <stdio.h>
+
+int fill_grids(const struct TSOpts *opts)
+{
+    struct SudokuCtx *ctx = sudoku_ctx_new();
+    if (ctx == NULL) {
+        perror("Allocating solver");
+        return 1;
+    }
+    sudoku_ctx_seed(ctx, opts->seed);
+    sudoku_ctx_set_variant(ctx, opts->variant);
+
+    for (unsigned long long i = 0; i < opts->fill_grids; i++) {
+        char grid[SUDOKU_LEN];
+        sudoku_fill(ctx, grid);
+        printf("%.*s\n", SUDOKU_LEN, grid);
+    }
+    if (opts->stats != STATS_OFF)
+        stats_print(ctx, opts->stats);
+    sudoku_ctx_free(ctx);
+
+    if (fflush(stdout) != 0) {
+        perror("Writing grids");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// The moves of a game in play, shared by the game on the terminal and the
+// sessions of the puzzle service. Every move goes into the history, so that
+// it can be undone. Moves on clues are refused.
+
+#include "game.h"
+
+#include "util.h"
+
+// Put 'digit' (1-9) into 'cell'. The notes of the cell are cleared, undoing
+// brings them back. False if nothing changed.
+bool game_insert(struct SudokuSpec *board, struct History *history, int cell, int digit)
+{
+    if (BOARD_IS_GIVEN(board, cell) || board->digits[cell] == digit)
+        return false;
+    return history_set(history, board, cell, digit, 0, false);
+}
+
+// Take the number out of 'cell', keeping its notes. False if there was none.
+bool game_erase(struct SudokuSpec *board, struct History *history, int cell)
+{
+    if (BOARD_IS_GIVEN(board, cell) || board->digits[cell] == 0)
+        return false;
+    return history_set(history, board, cell, 0, board->notes[cell], false);
+}
+
+// Note 'digit' (1-9) in 'cell', or take the note away again
+bool game_toggle_note(struct SudokuSpec *board, struct History *history, int cell, int digit)
+{
+    if (BOARD_IS_GIVEN(board, cell))
+        return false;
+    return history_set(history, board, cell, board->digits[cell],
+                       board->notes[cell] ^ BOARD_NOTE(digit), false);
+}
+
+// Whether the grid is filled out without breaking the rules
+bool game_check(const struct SudokuCtx *ctx, const struct SudokuSpec *board)
+{
+    char grid[SUDOKU_LEN];
+    board_grid_text(board, grid);
+    return sudoku_check_validity(ctx, grid);
+}
+
+// Fill out the grid from the numbers entered so far, as one move to undo.
+// False if there is no solution or the search was cancelled.
+bool game_solve(struct SudokuCtx *ctx, struct SudokuSpec *board, struct History *history)
+{
+    char grid[SUDOKU_LEN];
+    board_grid_text(board, grid);
+    if (!sudoku_solve(ctx, grid))
+        return false;
+
+    game_fill(board, history, grid);
+    return true;
+}
+
+// Write the solved 'grid' into the board as one move to undo
+void game_fill(struct SudokuSpec *board, struct History *history, const char *grid)
+{
+    bool joined = false;
+    for (int i = 0; i < SUDOKU_LEN; i++) {
+        if (!BOARD_IS_GIVEN(board, i) &&
+            history_set(history, board, i, CHNUM(grid[i]), board->notes[i], joined))
+            joined = true;
+    }
+}
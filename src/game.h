@@ -0,0 +1,32 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "board.h"
+#include "history.h"
+#include "sudoku.h"
+
+#include <stdbool.h>
+
+bool game_insert(struct SudokuSpec *board, struct History *history, int cell, int digit);
+bool game_erase(struct SudokuSpec *board, struct History *history, int cell);
+bool game_toggle_note(struct SudokuSpec *board, struct History *history, int cell, int digit);
+bool game_check(const struct SudokuCtx *ctx, const struct SudokuSpec *board);
+bool game_solve(struct SudokuCtx *ctx, struct SudokuSpec *board, struct History *history);
+void game_fill(struct SudokuSpec *board, struct History *history, const char *grid);
@@ -0,0 +1,211 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "history.h"
+
+#include "board.h"
+#include "sudoku.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct HistoryEdit *history_at(struct History *history, int i);
+bool history_reserve(struct History *history, int len);
+void history_push(struct History *history, const struct HistoryEdit *edit);
+
+// The i-th edit from the oldest one on
+struct HistoryEdit *history_at(struct History *history, int i)
+{
+    return &history->edits[(history->start + i) % history->cap];
+}
+
+void history_init(struct History *history)
+{
+    *history = (struct History){ 0 };
+}
+
+void history_free(struct History *history)
+{
+    free(history->edits);
+    history_init(history);
+}
+
+// Forget all edits, keeping the room for them
+void history_clear(struct History *history)
+{
+    history->start = 0;
+    history->done = 0;
+    history->undone = 0;
+}
+
+// Make room for 'len' edits, false if there is no memory for them or 'len' is
+// more than HISTORY_LEN
+bool history_reserve(struct History *history, int len)
+{
+    if (len <= history->cap)
+        return true;
+    if (len > HISTORY_LEN)
+        return false;
+
+    int cap = history->cap > 0 ? history->cap : HISTORY_MIN_LEN;
+    while (cap < len)
+        cap *= 2;
+    struct HistoryEdit *edits = realloc(history->edits, cap * sizeof(*edits));
+    if (edits == NULL)
+        return false;
+
+    // Unwrap the ring: the edits before 'start' go after the others. The room
+    // at least doubled, so they fit.
+    memcpy(edits + history->cap, edits, history->start * sizeof(*edits));
+    history->edits = edits;
+    history->cap = cap;
+    return true;
+}
+
+// Add an edit after the ones done, dropping the ones undone and, if the ring
+// is full and cannot grow, the oldest one. Without memory for any edit at all
+// it is not remembered.
+void history_push(struct History *history, const struct HistoryEdit *edit)
+{
+    history->undone = 0;
+
+    if (history->done == history->cap && !history_reserve(history, history->done + 1)) {
+        if (history->cap == 0)
+            return;
+        history->start = (history->start + 1) % history->cap;
+        history->done--;
+        // What is left of a group of edits is undone on its own
+        history_at(history, 0)->joined = false;
+    }
+
+    *history_at(history, history->done++) = *edit;
+}
+
+// Set the digit and the notes of a cell and remember the change, false if
+// nothing changed. 'joined' undoes the edit together with the one before.
+bool history_set(struct History *history, struct SudokuSpec *board, int cell, int digit, uint16_t notes, bool joined)
+{
+    if (board->digits[cell] == digit && board->notes[cell] == notes)
+        return false;
+
+    struct HistoryEdit edit = {
+        .notes_before = board->notes[cell],
+        .notes_after = notes,
+        .cell = cell,
+        .digit_before = board->digits[cell],
+        .digit_after = digit,
+        .joined = joined && history->done > 0,
+    };
+    history_push(history, &edit);
+
+    board->digits[cell] = digit;
+    board->notes[cell] = notes;
+    return true;
+}
+
+// Take back the last edit (with the ones joined to it), returns its cell or
+// -1 if there is nothing to undo
+int history_undo(struct History *history, struct SudokuSpec *board)
+{
+    if (history->done == 0)
+        return -1;
+
+    const struct HistoryEdit *edit;
+    do {
+        edit = history_at(history, --history->done);
+        history->undone++;
+        board->digits[edit->cell] = edit->digit_before;
+        board->notes[edit->cell] = edit->notes_before;
+    } while (edit->joined);
+
+    return edit->cell;
+}
+
+// Do the last edit that was undone again, returns its cell or -1 if there is
+// nothing to redo
+int history_redo(struct History *history, struct SudokuSpec *board)
+{
+    if (history->undone == 0)
+        return -1;
+
+    const struct HistoryEdit *edit;
+    do {
+        edit = history_at(history, history->done++);
+        history->undone--;
+        board->digits[edit->cell] = edit->digit_after;
+        board->notes[edit->cell] = edit->notes_after;
+    } while (history->undone > 0 && history_at(history, history->done)->joined);
+
+    return edit->cell;
+}
+
+// Append the edits to a save file: a line "history DONE UNDONE", then one line
+// per edit, oldest first
+void history_write(const struct History *history, FILE *out)
+{
+    int len = history->done + history->undone;
+
+    fprintf(out, "history %d %d\n", history->done, history->undone);
+    for (int i = 0; i < len; i++) {
+        const struct HistoryEdit *edit = &history->edits[(history->start + i) % history->cap];
+        fprintf(out, "%d %d %d %d %d %d\n", edit->cell, edit->digit_before, edit->digit_after,
+                edit->notes_before, edit->notes_after, edit->joined);
+    }
+}
+
+// Read the edits after the game of a save file. Files without them have an
+// empty history, and so has a history that does not fit the game (false).
+bool history_read(struct History *history, const struct SudokuSpec *board, FILE *in)
+{
+    history_clear(history);
+
+    int done, undone;
+    int read = fscanf(in, " history %d %d", &done, &undone);
+    if (read == EOF)
+        return true;
+    if (read != 2 || done < 0 || undone < 0 || !history_reserve(history, done + undone))
+        return false;
+
+    for (int i = 0; i < done + undone; i++) {
+        int cell, digit_before, digit_after, notes_before, notes_after, joined;
+        if (fscanf(in, "%d %d %d %d %d %d", &cell, &digit_before, &digit_after,
+                   &notes_before, &notes_after, &joined) != 6)
+            return false;
+        if (cell < 0 || cell >= SUDOKU_LEN || BOARD_IS_GIVEN(board, cell) ||
+            digit_before < 0 || digit_before > LINE_LEN || digit_after < 0 || digit_after > LINE_LEN ||
+            notes_before < 0 || notes_before > (int)BOARD_NOTES_ALL ||
+            notes_after < 0 || notes_after > (int)BOARD_NOTES_ALL)
+            return false;
+
+        history->edits[i] = (struct HistoryEdit){
+            .notes_before = notes_before,
+            .notes_after = notes_after,
+            .cell = cell,
+            .digit_before = digit_before,
+            .digit_after = digit_after,
+            .joined = joined && i > 0,
+        };
+    }
+
+    history->done = done;
+    history->undone = undone;
+    return true;
+}
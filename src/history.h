@@ -0,0 +1,62 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Edits kept for undo, older ones are dropped
+#define HISTORY_LEN 4096
+// Edits there is room for at first, the room doubles up to HISTORY_LEN as
+// it is needed
+#define HISTORY_MIN_LEN 16
+
+struct SudokuSpec;
+
+// A cell before and after an edit
+struct HistoryEdit {
+    uint16_t notes_before;
+    uint16_t notes_after;
+    uint8_t cell;
+    uint8_t digit_before;
+    uint8_t digit_after;
+    // Undone and redone together with the edit before it
+    bool joined;
+};
+
+// Ring of the last HISTORY_LEN edits: 'done' edits from 'start' on can be
+// undone, the 'undone' edits after them redone. A history of zeros is empty,
+// 'edits' is only allocated with the first edit.
+struct History {
+    struct HistoryEdit *edits;
+    int cap;
+    int start;
+    int done;
+    int undone;
+};
+
+void history_init(struct History *history);
+void history_free(struct History *history);
+void history_clear(struct History *history);
+bool history_set(struct History *history, struct SudokuSpec *board, int cell, int digit, uint16_t notes, bool joined);
+int history_undo(struct History *history, struct SudokuSpec *board);
+int history_redo(struct History *history, struct SudokuSpec *board);
+void history_write(const struct History *history, FILE *out);
+bool history_read(struct History *history, const struct SudokuSpec *board, FILE *in);
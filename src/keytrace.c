@@ -0,0 +1,229 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Recording of the keys of a session and headless replay of such a recording.
+// A trace is a text file with one "<microseconds since start> <key code>" line
+// per key. On replay the keys are fed to the game as fast as possible while
+// the time spent handling each key, the time spent drawing and the number of
+// bytes sent to the terminal are measured. The report is printed on exit.
+
+#include "keytrace.h"
+
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Measurements for a single replayed key
+struct KeySample {
+    long long handling_ns;
+    long long draw_ns;
+    long long bytes;
+};
+
+static struct {
+    FILE *record;
+    long long record_start;
+
+    FILE *replay;
+    // Where the report goes, since stdout is swallowed during replay
+    int report_fd;
+    struct KeySample *samples;
+    size_t samples_len;
+    size_t samples_cap;
+    bool key_open;
+    long long key_start;
+    long long draw_start;
+    long long draw_ns;
+    long long bytes_start;
+} trace = { .report_fd = -1 };
+
+void keytrace_close(void);
+
+static long long keytrace_bytes_out(void)
+{
+    fflush(stdout);
+    off_t pos = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+    return pos < 0 ? 0 : pos;
+}
+
+bool keytrace_record_open(const char *path)
+{
+    trace.record = fopen(path, "w");
+    if (trace.record == NULL)
+        return false;
+
+    fprintf(trace.record, "# term-sudoku key trace\n");
+    trace.record_start = monotonic_ns();
+    atexit(keytrace_close);
+
+    return true;
+}
+
+// Open a trace for replay and swallow everything the renderer writes into a
+// temporary file, so that the emitted bytes can be counted without a terminal
+bool keytrace_replay_open(const char *path)
+{
+    trace.replay = fopen(path, "r");
+    if (trace.replay == NULL)
+        return false;
+
+    FILE *sink = tmpfile();
+    if (sink == NULL)
+        return false;
+
+    fflush(stdout);
+    trace.report_fd = dup(STDOUT_FILENO);
+    if (trace.report_fd == -1 || dup2(fileno(sink), STDOUT_FILENO) == -1)
+        return false;
+
+    atexit(keytrace_close);
+
+    return true;
+}
+
+bool keytrace_replaying(void)
+{
+    return trace.replay != NULL;
+}
+
+void keytrace_record(int key)
+{
+    if (trace.record == NULL)
+        return;
+
+    fprintf(trace.record, "%lld %d\n", (monotonic_ns() - trace.record_start) / 1000, key);
+}
+
+// Close the measurement of the key that is currently being handled
+static void keytrace_end_key(void)
+{
+    if (!trace.key_open)
+        return;
+    trace.key_open = false;
+
+    if (trace.samples_len == trace.samples_cap) {
+        trace.samples_cap = trace.samples_cap ? trace.samples_cap * 2 : 256;
+        trace.samples = realloc(trace.samples, trace.samples_cap * sizeof(*trace.samples));
+        if (trace.samples == NULL)
+            finish_with_errno("Recording key samples");
+    }
+
+    trace.samples[trace.samples_len++] = (struct KeySample){
+        .handling_ns = monotonic_ns() - trace.key_start,
+        .draw_ns = trace.draw_ns,
+        .bytes = keytrace_bytes_out() - trace.bytes_start,
+    };
+}
+
+// Next key of the replayed trace; exits (printing the report) when the trace
+// is exhausted
+int keytrace_next_key(void)
+{
+    keytrace_end_key();
+
+    char line[64];
+    long long timestamp;
+    int key;
+    do {
+        if (fgets(line, sizeof(line), trace.replay) == NULL)
+            finish(0);
+    } while (line[0] == '#' || sscanf(line, "%lld %d", &timestamp, &key) != 2);
+
+    trace.key_open = true;
+    trace.draw_ns = 0;
+    trace.bytes_start = keytrace_bytes_out();
+    trace.key_start = monotonic_ns();
+
+    return key;
+}
+
+void keytrace_draw_begin(void)
+{
+    trace.draw_start = monotonic_ns();
+}
+
+void keytrace_draw_end(void)
+{
+    trace.draw_ns += monotonic_ns() - trace.draw_start;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Sort 'values' and print its 50th and 99th percentile, maximum and total
+static void keytrace_report_line(FILE *out, const char *name, long long *values, size_t n, double scale)
+{
+    qsort(values, n, sizeof(*values), cmp_ll);
+
+    long long total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += values[i];
+
+    fprintf(out, "%-14s p50 %10.1f  p99 %10.1f  max %10.1f  total %12.1f\n", name,
+            values[n / 2] / scale, values[(n * 99) / 100] / scale, values[n - 1] / scale, total / scale);
+}
+
+void keytrace_close(void)
+{
+    if (trace.record != NULL) {
+        fclose(trace.record);
+        trace.record = NULL;
+    }
+
+    if (trace.replay == NULL)
+        return;
+
+    keytrace_end_key();
+    fclose(trace.replay);
+    trace.replay = NULL;
+
+    FILE *out = fdopen(trace.report_fd, "w");
+    if (out == NULL)
+        return;
+
+    fprintf(out, "keys replayed: %zu\n", trace.samples_len);
+    if (trace.samples_len > 0) {
+        long long *values = malloc(trace.samples_len * sizeof(*values));
+        if (values == NULL)
+            return;
+
+        for (size_t i = 0; i < trace.samples_len; i++)
+            values[i] = trace.samples[i].handling_ns;
+        keytrace_report_line(out, "handling (us)", values, trace.samples_len, 1000.0);
+        for (size_t i = 0; i < trace.samples_len; i++)
+            values[i] = trace.samples[i].draw_ns;
+        keytrace_report_line(out, "draw (us)", values, trace.samples_len, 1000.0);
+        for (size_t i = 0; i < trace.samples_len; i++)
+            values[i] = trace.samples[i].bytes;
+        keytrace_report_line(out, "bytes", values, trace.samples_len, 1.0);
+
+        free(values);
+    }
+
+    fclose(out);
+    free(trace.samples);
+    trace.samples = NULL;
+}
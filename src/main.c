@@ -18,12 +18,20 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "main.h"
 
-#include "ncurses_render.h"
+#include "board.h"
+#include "count.h"
+#include "fill.h"
+#include "game.h"
+#include "history.h"
+#include "keytrace.h"
+#include "render.h"
+#include "server.h"
+#include "shard.h"
 #include "sudoku.h"
 #include "util.h"
 
-#include <curses.h>
 #include <errno.h>
+#include <getopt.h>
 #include <pwd.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -38,11 +46,58 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <sys/random.h>
 #endif
 
-void new_sudoku(struct TSStruct *spec);
+// Upper bound for applying queued keys before the screen is redrawn
+#define BATCH_MAX_KEYS 256
+#define BATCH_MAX_NS 16000000LL
+// A search has to run this long before its progress is shown, and the
+// progress is redrawn at most this often
+#define PROGRESS_REDRAW_NS 100000000LL
+// How often the keys are polled while the solutions of an entered puzzle are
+// being counted
+#define CHECK_POLL_NS 10000000LL
+#define KEY_ESCAPE 27
+
+// What handling a key asks of the loop of a view
+enum KeyResult {
+    KEY_CONTINUE,
+    KEY_DONE,
+    KEY_QUIT,
+};
+
+typedef enum KeyResult (*KeyHandler)(struct TSStruct *spec, int key_press, bool *redraw);
+
+// State of show_progress() during a search
+struct ProgressView {
+    struct TSStruct *spec;
+    // What is running, e.g. "Solving"
+    const char *action;
+    // Draw the progress, off while the generation is shown visually
+    bool show;
+    long long last_draw;
+};
+
+bool move_by_key(struct Cursor *curs, int key_press);
+void show_check_result(struct TSStruct *spec);
+enum CheckState update_check(struct TSStruct *spec);
+int wait_key(struct TSStruct *spec);
+enum KeyResult handle_key_batch(struct TSStruct *spec, KeyHandler handler);
+void visual_step(const char *sudoku, void *user);
+bool show_progress(const struct SudokuProgress *progress, void *user);
+void begin_progress(struct TSStruct *spec, struct ProgressView *view, const char *action);
+void end_progress(struct TSStruct *spec);
+bool new_sudoku(struct TSStruct *spec);
 void input_go_to(struct TSStruct *spec);
-bool own_sudoku_view(struct TSStruct *spec);
+enum KeyResult own_sudoku_key(struct TSStruct *spec, int key_press, bool *redraw);
+void validate_own_sudoku(struct TSStruct *spec);
+void paste_own_sudoku(struct TSStruct *spec);
+bool own_sudoku_view(struct TSStruct *spec, const char *imported);
+bool read_sudoku_file(const char *path, char *parsed);
 bool fileview(struct TSStruct *spec);
+enum KeyResult mainloop_key(struct TSStruct *spec, int key_press, bool *redraw);
 void mainloop(struct TSStruct *spec);
+bool parse_difficulty(const char *name, enum SudokuGrade *grade);
+bool parse_shard(const char *arg, int *index, int *count);
+void set_default_dir(struct TSOpts *opts);
 
 const char *controls_default = "move - h, j, k and l or arrow keys\n"
                                "1-9 - insert numbers\n"
@@ -53,10 +108,187 @@ const char *controls_default = "move - h, j, k and l or arrow keys\n"
                                "notetaking mode - e\n"
                                "go to position - g\n"
                                "highlight number - v\n"
+                               "undo - u, redo - r\n"
                                "quit - q\n";
 
-// Generate a new sudoku for the user to solve
-void new_sudoku(struct TSStruct *spec)
+// Move the cursor if key_press is a movement key (vim keys or arrow keys),
+// bound to the field size
+bool move_by_key(struct Cursor *curs, int key_press)
+{
+    switch (key_press) {
+    case TS_KEY_LEFT:
+    case 'h':
+        curs->x = curs->x - 1 < 0 ? curs->x : curs->x - 1;
+        return true;
+    case TS_KEY_DOWN:
+    case 'j':
+        curs->y = curs->y + 1 >= LINE_LEN ? curs->y : curs->y + 1;
+        return true;
+    case TS_KEY_UP:
+    case 'k':
+        curs->y = curs->y - 1 < 0 ? curs->y : curs->y - 1;
+        return true;
+    case TS_KEY_RIGHT:
+    case 'l':
+        curs->x = curs->x + 1 >= LINE_LEN ? curs->x : curs->x + 1;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Write what the checker found out about the entered puzzle to the statusbar
+void show_check_result(struct TSStruct *spec)
+{
+    switch (spec->check.solutions) {
+    case -1:
+        sprintf(spec->statusbar, "%s", "Solutions: unknown, the search took too long");
+        break;
+    case 0:
+        sprintf(spec->statusbar, "%s", spec->check.narrowing ? "Solutions: 0, looking for the clues at fault"
+                                                             : "Solutions: 0, the clues in red cannot all stay");
+        break;
+    case 1:
+        sprintf(spec->statusbar, "%s", "Solutions: 1");
+        break;
+    default:
+        sprintf(spec->statusbar, "%s", "Solutions: many");
+        break;
+    }
+}
+
+// Take the results that came in from the checker, CHECK_RUNNING while it
+// still works on the entered puzzle
+enum CheckState update_check(struct TSStruct *spec)
+{
+    enum CheckState state;
+    while ((state = checker_poll(spec->checker, &spec->check)) == CHECK_DONE)
+        show_check_result(spec);
+
+    return state;
+}
+
+// Wait for a key. While the checker counts the solutions of the entered
+// puzzle, its results are drawn as they come in.
+int wait_key(struct TSStruct *spec)
+{
+    if (spec->checker == NULL || keytrace_replaying())
+        return get_key();
+
+    const struct timespec poll_interval = { 0, CHECK_POLL_NS };
+    long long start = monotonic_ns();
+    bool shown = false;
+
+    for (;;) {
+        enum CheckState state = checker_poll(spec->checker, &spec->check);
+        if (state == CHECK_DONE) {
+            show_check_result(spec);
+            draw(spec);
+            shown = true;
+            continue;
+        }
+        if (state == CHECK_IDLE)
+            return get_key();
+
+        int key_press = poll_key();
+        if (key_press != TS_KEY_NONE)
+            return key_press;
+
+        if (!shown && monotonic_ns() - start >= PROGRESS_REDRAW_NS) {
+            sprintf(spec->statusbar, "%s", "Solutions: counting...");
+            draw(spec);
+            shown = true;
+        }
+        nanosleep(&poll_interval, NULL);
+    }
+}
+
+// Wait for a key, then apply it and every key that is already waiting (key
+// repeat, pasted text) with 'handler' before drawing once. The batch is cut
+// off after BATCH_MAX_KEYS keys or BATCH_MAX_NS so the screen never falls
+// behind for long.
+enum KeyResult handle_key_batch(struct TSStruct *spec, KeyHandler handler)
+{
+    bool redraw = false;
+    enum KeyResult result;
+
+    int key_press = wait_key(spec);
+    long long batch_start = monotonic_ns();
+    int batch_len = 0;
+
+    do {
+        result = handler(spec, key_press, &redraw);
+    } while (result == KEY_CONTINUE && ++batch_len < BATCH_MAX_KEYS &&
+             monotonic_ns() - batch_start < BATCH_MAX_NS &&
+             (key_press = poll_key()) != TS_KEY_NONE);
+
+    if (result == KEY_CONTINUE) {
+        if (redraw)
+            draw(spec);
+        else
+            move_cursor(spec->cursor, spec->opts->small_mode);
+    }
+
+    return result;
+}
+
+// Step callback of the generator for '-v'
+void visual_step(const char *sudoku, void *user)
+{
+    (void)user;
+    generate_visually(sudoku);
+}
+
+// Progress callback of the solver: show how far a long search got in the
+// statusbar and cancel it when 'q' or Escape is pressed
+bool show_progress(const struct SudokuProgress *progress, void *user)
+{
+    struct ProgressView *view = user;
+
+    int key_press;
+    while ((key_press = poll_key()) != TS_KEY_NONE) {
+        if (key_press == 'q' || key_press == KEY_ESCAPE)
+            return false;
+    }
+
+    long long now = monotonic_ns();
+    if (!view->show || now - view->last_draw < PROGRESS_REDRAW_NS)
+        return true;
+    view->last_draw = now;
+
+    if (progress->phase == SUDOKU_PHASE_REMOVE)
+        snprintf(view->spec->statusbar, sizeof(view->spec->statusbar),
+                 "%s: %d clues removed, q to cancel", view->action, progress->removed);
+    else
+        snprintf(view->spec->statusbar, sizeof(view->spec->statusbar),
+                 "%s: %lluk positions tried, q to cancel", view->action, progress->nodes / 1000);
+    draw(view->spec);
+
+    return true;
+}
+
+// Show the progress of the searches of spec->ctx until end_progress()
+void begin_progress(struct TSStruct *spec, struct ProgressView *view, const char *action)
+{
+    *view = (struct ProgressView){
+        .spec = spec,
+        .action = action,
+        .show = true,
+        .last_draw = monotonic_ns(),
+    };
+    sudoku_ctx_set_progress_callback(spec->ctx, show_progress, view);
+}
+
+void end_progress(struct TSStruct *spec)
+{
+    sudoku_ctx_set_progress_callback(spec->ctx, NULL, NULL);
+
+    if (spec->opts->stats != STATS_OFF)
+        stats_format_line(spec->ctx, spec->debugline, sizeof(spec->debugline));
+}
+
+// Generate a new sudoku for the user to solve, false if the user cancelled
+bool new_sudoku(struct TSStruct *spec)
 {
     struct TSOpts *opts = spec->opts;
     struct SudokuSpec *sudoku = spec->sudoku;
@@ -64,16 +296,49 @@ void new_sudoku(struct TSStruct *spec)
     // Writes a filename from current date and time
     gen_file_name(opts->filename, sizeof(opts->filename), opts->dir);
 
-    memset(sudoku->sudoku,  '0',    sizeof(sudoku->sudoku));
-    memset(sudoku->user,    '0',    sizeof(sudoku->user));
-    memset(sudoku->notes,    0,     sizeof(sudoku->notes));
+    board_clear(sudoku);
+    history_clear(spec->history);
+    sudoku->variant = opts->variant;
+    sudoku_ctx_set_variant(spec->ctx, opts->variant);
+
+    sudoku_ctx_set_attempts(spec->ctx, opts->attempts);
+    sudoku_ctx_set_time_budget(spec->ctx, opts->time_budget);
+
+    long long start = monotonic_ns();
+    struct ProgressView view;
+    begin_progress(spec, &view, "Generating");
+
+    // The grid is filled in the background and only shown once it is done,
+    // unless the generation is shown visually
+    char generated[SUDOKU_LEN];
+    if (opts->gen_visual) {
+        view.show = false;
+        show_cursor(false);
+        sudoku_ctx_set_step_callback(spec->ctx, visual_step, NULL);
+    }
+
+    bool done = sudoku_generate(spec->ctx, generated);
 
-    generate_sudoku(sudoku->sudoku, opts);
+    if (opts->gen_visual) {
+        sudoku_ctx_set_step_callback(spec->ctx, NULL, NULL);
+        if (done)
+            end_visual_generation(generated);
+        show_cursor(true);
+    }
+    end_progress(spec);
+
+    if (!done) {
+        sprintf(spec->statusbar, "%s", "Generation cancelled");
+        return false;
+    }
 
-    sprintf(spec->statusbar, "%s", "Sudoku generated");
+    board_set_clues(sudoku, generated);
+    sprintf(spec->statusbar, "Sudoku generated: %s, %lld ms",
+            sudoku_grade_name(sudoku_grade(spec->ctx, generated)), (monotonic_ns() - start) / 1000000);
+    return true;
 }
 
-// Ask for position (getch()) and go there
+// Ask for position (get_key()) and go there
 void input_go_to(struct TSStruct *spec)
 {
     int move_to[2] = {0, 0};
@@ -82,7 +347,7 @@ void input_go_to(struct TSStruct *spec)
     draw(spec);
 
     for (int i = 0; i < 2; i++) {
-        char c_pos = getch();
+        char c_pos = get_key();
         move_to[i] = CHNUM(c_pos);
         if (move_to[i] <= 0 || move_to[i] > 9) {
             sprintf(spec->statusbar, "%s", "Cancelled");
@@ -96,98 +361,193 @@ void input_go_to(struct TSStruct *spec)
     move_cursor_to(spec->cursor, spec->opts->small_mode, move_to[0] - 1, move_to[1] - 1);
 }
 
-bool own_sudoku_view(struct TSStruct *spec)
+// Handle a single key of own_sudoku_view()
+enum KeyResult own_sudoku_key(struct TSStruct *spec, int key_press, bool *redraw)
+{
+    struct SudokuSpec *sudoku = spec->sudoku;
+    struct Cursor *curs = spec->cursor;
+
+    if (move_by_key(curs, key_press))
+        return KEY_CONTINUE;
+
+    switch (key_press) {
+    case 'd':
+        // Without a solution the game cannot be won
+        if (update_check(spec) == CHECK_RUNNING ? spec->check.narrowing : spec->check.solutions == 0) {
+            sprintf(spec->statusbar, "%s", "No solution, change the clues in red first");
+            *redraw = true;
+            break;
+        }
+        if (!status_bar_confirmation(spec))
+            break;
+
+        return KEY_DONE;
+    case 'g':
+        input_go_to(spec);
+        break;
+    case 'p':
+        paste_own_sudoku(spec);
+        break;
+    case 'q':
+        if (!status_bar_confirmation(spec))
+            break;
+
+        return KEY_QUIT;
+    // Input numbers into the user sudoku field
+    default:
+    {
+        // Check if the key is a number (not zero) in aasci chars or 'x' and
+        // if the cursor is not an a field filled by the puzzle
+        int cell = curs->y * LINE_LEN + curs->x;
+
+        // check for numbers
+        if (key_press >= '1' && key_press <= '9' &&
+            sudoku->digits[cell] != CHNUM(key_press)) {
+            board_set_clue(sudoku, cell, CHNUM(key_press));
+            validate_own_sudoku(spec);
+            *redraw = true;
+        }
+        // check for x
+        else if ((key_press == 'x' || key_press == '0') &&
+                 sudoku->digits[cell] != 0) {
+            board_set_clue(sudoku, cell, 0);
+            validate_own_sudoku(spec);
+            *redraw = true;
+        }
+        break;
+    }
+    }
+
+    return KEY_CONTINUE;
+}
+
+// Have the checker count the solutions of the entered puzzle, the result is
+// drawn once it comes in (see wait_key())
+void validate_own_sudoku(struct TSStruct *spec)
+{
+    char sudoku[SUDOKU_LEN];
+    board_clues_text(spec->sudoku, sudoku);
+
+    checker_submit(spec->checker, sudoku);
+    // Whatever was being narrowed down belongs to the puzzle before
+    spec->check.narrowing = false;
+}
+
+// Read a whole puzzle at once (pasted or typed): keys are collected until
+// SUDOKU_LEN cells have been read, the puzzle is validated and drawn once.
+// Escape or any other character that is not part of a puzzle cancels.
+void paste_own_sudoku(struct TSStruct *spec)
+{
+    char text[SUDOKU_LEN * 4];
+    size_t len = 0;
+    char parsed[SUDOKU_LEN];
+    int cells = 0;
+
+    sprintf(spec->statusbar, "Paste puzzle: %d/%d", cells, SUDOKU_LEN);
+    draw(spec);
+
+    while (cells < SUDOKU_LEN) {
+        // Take everything that is already waiting before updating the
+        // progress, so a paste is read in one go
+        int key_press = get_key();
+        do {
+            if (len == sizeof(text)) {
+                cells = -1;
+                break;
+            }
+            text[len++] = key_press;
+            cells = sudoku_parse(text, len, parsed);
+        } while (cells >= 0 && cells < SUDOKU_LEN && (key_press = poll_key()) != TS_KEY_NONE);
+
+        if (cells < 0) {
+            sprintf(spec->statusbar, "%s", "Cancelled");
+            draw(spec);
+            return;
+        }
+
+        sprintf(spec->statusbar, "Paste puzzle: %d/%d", cells, SUDOKU_LEN);
+        draw(spec);
+    }
+
+    board_set_clues(spec->sudoku, parsed);
+    validate_own_sudoku(spec);
+    draw(spec);
+}
+
+// Read a puzzle from a file ("-" for stdin) in the format of sudoku_parse()
+bool read_sudoku_file(const char *path, char *parsed)
+{
+    bool from_stdin = strcmp(path, "-") == 0;
+    FILE *input_file = from_stdin ? stdin : fopen(path, "r");
+    if (input_file == NULL)
+        return false;
+
+    char text[SUDOKU_LEN * 8];
+    size_t len = fread(text, 1, sizeof(text), input_file);
+
+    if (!from_stdin)
+        fclose(input_file);
+
+    // The keys have to come from the terminal once stdin is used up
+    if (from_stdin && !isatty(STDIN_FILENO))
+        (void)freopen("/dev/tty", "r", stdin);
+
+    errno = EINVAL;
+    return sudoku_parse(text, len, parsed) == SUDOKU_LEN;
+}
+
+// Let the user enter a puzzle, starting from 'imported' if it is not NULL
+bool own_sudoku_view(struct TSStruct *spec, const char *imported)
 {
     spec->cursor->x = spec->cursor->y = 0;
 
     struct TSOpts *opts = spec->opts;
     struct SudokuSpec *sudoku = spec->sudoku;
-    struct Cursor *curs = spec->cursor;
 
     gen_file_name(opts->filename, sizeof(opts->filename), opts->dir);
 
-    // Clear sudoku arrays
-    memset(sudoku->sudoku, '0', SUDOKU_LEN);
-    memset(sudoku->user, '0', SUDOKU_LEN);
-    memset(sudoku->notes, 0, sizeof(sudoku->notes));
+    board_clear(sudoku);
+    history_clear(spec->history);
+    sudoku->variant = opts->variant;
+    sudoku_ctx_set_variant(spec->ctx, opts->variant);
+
+    spec->checker = checker_new(opts->variant);
+    if (spec->checker == NULL)
+        finish_with_err_msg("Starting the solution checker failed\n");
 
     sprintf(spec->statusbar, "%s", "Enter your sudoku");
+    if (imported != NULL) {
+        board_set_clues(sudoku, imported);
+        validate_own_sudoku(spec);
+    }
+
     // Controls displayed only in this view
     const char *custom_sudoku_controls = "move - h, j, k and l or arrow keys\n"
                                          "1-9 - insert numbers\n"
                                          "x or 0 - delete numbers\n"
+                                         "paste whole puzzle - p\n"
                                          "done - d\n"
                                          "go to position - g\n"
                                          "quit - q\n";
     spec->controls = custom_sudoku_controls;
     // Draw with new controls
     draw(spec);
-    bool done = false;
-    bool quit = false;
 
     // Loop for entering own sudoku
-    while (!done && !quit) {
-        int key_press = getch();
-        // Move on vim keys and bind to field size
-        switch (key_press) {
-        case KEY_LEFT:
-        case 'h':
-            curs->x = curs->x - 1 < 0 ? curs->x : curs->x - 1;
-            goto move;
-        case KEY_DOWN:
-        case 'j':
-            curs->y = curs->y + 1 >= LINE_LEN ? curs->y : curs->y + 1;
-            goto move;
-        case KEY_UP:
-        case 'k':
-            curs->y = curs->y - 1 < 0 ? curs->y : curs->y - 1;
-            goto move;
-        case KEY_RIGHT:
-        case 'l':
-            curs->x = curs->x + 1 >= LINE_LEN ? curs->x : curs->x + 1;
-            goto move;
-        move:
-            move_cursor(curs, opts->small_mode);
-            break;
-        case 'd':
-            if (!status_bar_confirmation(spec)) break;
+    enum KeyResult result;
+    do {
+        result = handle_key_batch(spec, own_sudoku_key);
+    } while (result == KEY_CONTINUE);
 
-            done = true;
-            break;
-        case 'g':
-            input_go_to(spec);
-            break;
-        case 'q':
-            if (!status_bar_confirmation(spec))
-                break;
-
-            quit = true;
-            break;
-        // Input numbers into the user sudoku field
-        default:
-            // Check if the key is a number (not zero) in aasci chars or 'x' and
-            // if the cursor is not an a field filled by the puzzle
+    checker_free(spec->checker);
+    spec->checker = NULL;
+    memset(&spec->check, 0, sizeof(spec->check));
 
-            // check for numbers
-            if (key_press >= '1' && key_press <= '9' &&
-                sudoku->sudoku[curs->y * LINE_LEN + curs->x] != key_press) {
-                sudoku->sudoku[curs->y * LINE_LEN + curs->x] = key_press;
-                draw(spec);
-            }
-            // check for x
-            else if ((key_press == 'x' || key_press == '0') &&
-                     sudoku->sudoku[curs->y * LINE_LEN + curs->x] != '0') {
-                sudoku->sudoku[curs->y * LINE_LEN + curs->x] = '0';
-                draw(spec);
-            }
-            break;
-        }
-    }
     // Reset controls
     spec->controls = controls_default;
     sprintf(spec->statusbar, "Sudoku entered");
 
-    return !quit;
+    return result != KEY_QUIT;
 }
 
 bool fileview(struct TSStruct *spec)
@@ -198,7 +558,7 @@ bool fileview(struct TSStruct *spec)
     // Load files in directory into items
     char **items = listfiles(spec->opts->dir, &iterator);
 
-    curs_set(0);
+    show_cursor(false);
 
     bool chosen = false;
     bool new_file = false;
@@ -214,29 +574,17 @@ bool fileview(struct TSStruct *spec)
 
     // Choose file by moving cursor
     while (!chosen && !new_file && !own) {
-        const int filestart = 4;
-
-        erase();
-
-        mvprintw(0, 0, "%s", file_view_controls);
-
-        mvprintw(2, 0, "%s", spec->opts->dir);
+        draw_fileview(file_view_controls, spec->opts->dir, items, iterator, position);
 
-        for (int j = 0; j < iterator; j++)
-            mvprintw(j + filestart, 4, "  %s\n", items[j]);
-
-        // Asteriks as cursor for file selection
-        mvaddch(position + filestart, 4, '*');
-
-        int key_press = getch();
+        int key_press = get_key();
 
         // Move on vim keys and bind to item size later
         switch (key_press) {
-        case KEY_DOWN:
+        case TS_KEY_DOWN:
         case 'j':
             position += 1;
             break;
-        case KEY_UP:
+        case TS_KEY_UP:
         case 'k':
             position -= 1;
             break;
@@ -287,7 +635,7 @@ bool fileview(struct TSStruct *spec)
         }
     }
 
-    curs_set(1);
+    show_cursor(true);
 
     // Reading the file
     if (chosen) {
@@ -299,23 +647,26 @@ bool fileview(struct TSStruct *spec)
             finish_with_errno(spec->opts->filename);
         }
 
-        // Scan in the first two lines which are the puzzle and the entered
-        // user_nums
-        fscanf(input_file, "%s\n%s\n", spec->sudoku->sudoku, spec->sudoku->user);
-        // Read in notes into the array
-        for (int i = 0; i < SUDOKU_LEN * LINE_LEN; i++)
-            fscanf(input_file, "%1d", &spec->sudoku->notes[i]);
+        // The puzzle, the numbers of the user and the notes, then the undo
+        // history if it was saved
+        if (!board_read(spec->sudoku, input_file)) {
+            fclose(input_file);
+            finish_with_err_msg("%s: not a saved sudoku\n", spec->opts->filename);
+        }
+        bool history_read_ok = history_read(spec->history, spec->sudoku, input_file);
         fclose(input_file);
+        sudoku_ctx_set_variant(spec->ctx, spec->sudoku->variant);
 
-        sprintf(spec->statusbar, "%s", "File opened");
+        sprintf(spec->statusbar, "%s", history_read_ok ? "File opened" : "File opened, history discarded");
 
         mainloop(spec);
     } else if (own) {
-        if (own_sudoku_view(spec))
+        if (own_sudoku_view(spec, NULL))
             mainloop(spec);
     } else if (new_file) {
-        new_sudoku(spec);
-        mainloop(spec);
+        // Back to the list if the generation is cancelled
+        if (new_sudoku(spec))
+            mainloop(spec);
     }
 
     freefiles(items, iterator);
@@ -323,201 +674,342 @@ bool fileview(struct TSStruct *spec)
     return true;
 }
 
-/*
-** Draws the sudoku and processes input relating to modifying the sudoku,
-*changing something about the rendering or moving the cursor
-*/
-void mainloop(struct TSStruct *spec)
+// Handle a single key of mainloop()
+enum KeyResult mainloop_key(struct TSStruct *spec, int key_press, bool *redraw)
 {
     struct TSOpts *opts = spec->opts;
     struct SudokuSpec *sudoku = spec->sudoku;
     struct Cursor *curs = spec->cursor;
 
-    curs->x = curs->y = 0;
-
-    draw(spec);
+    if (move_by_key(curs, key_press))
+        return KEY_CONTINUE;
+
+    switch (key_press) {
+    // Save file and handle errors
+    case 's':
+        if (!savestate(opts->filename, sudoku, opts->save_history ? spec->history : NULL))
+            sprintf(spec->statusbar, "Error: '%s'\n", strerror(errno));
+        else
+            sprintf(spec->statusbar, "%s", "Saved");
+
+        *redraw = true;
+        break;
+    // Check for errors and write result to statusbar
+    case 'c':
+        if (game_check(spec->ctx, sudoku))
+            sprintf(spec->statusbar, "%s", "Valid");
+        else
+            sprintf(spec->statusbar, "%s", "Invalid or not filled out");
+
+        *redraw = true;
+        break;
+    // Fill out sudoku; ask for confirmation first
+    case 'd':
+        if (!status_bar_confirmation(spec))
+            break;
 
-    bool quit = false;
-    // Main loop: wait for keypress, then process it
-    while (!quit) {
-        int key_press = getch();
-        switch (key_press) {
-        // Move on vim keys and bind to field size
-        case KEY_LEFT:
-        case 'h':
-            curs->x = curs->x - 1 < 0 ? curs->x : curs->x - 1;
-            goto move;
-        case KEY_DOWN:
-        case 'j':
-            curs->y = curs->y + 1 >= LINE_LEN ? curs->y : curs->y + 1;
-            goto move;
-        case KEY_UP:
-        case 'k':
-            curs->y = curs->y - 1 < 0 ? curs->y : curs->y - 1;
-            goto move;
-        case KEY_RIGHT:
-        case 'l':
-            curs->x = curs->x + 1 >= LINE_LEN ? curs->x : curs->x + 1;
-            goto move;
-        move:
-            move_cursor(curs, opts->small_mode);
-            break;
-        // Save file and handle errors
-        case 's':
-            if (!savestate(opts->filename, sudoku))
-                sprintf(spec->statusbar, "Error: '%s'\n", strerror(errno));
-            else
-                sprintf(spec->statusbar, "%s", "Saved");
+        struct ProgressView view;
+        begin_progress(spec, &view, "Solving");
+        bool solved = game_solve(spec->ctx, sudoku, spec->history);
+        end_progress(spec);
 
-            draw(spec);
+        if (solved) {
+            sprintf(spec->statusbar, "%s", "Solved");
+        } else if (sudoku_cancelled(spec->ctx)) {
+            sprintf(spec->statusbar, "%s", "Solving cancelled");
+        } else {
+            sprintf(spec->statusbar, "%s", "No solution, check the entered numbers");
+        }
 
+        *redraw = true;
+        break;
+    // Enter edit mode
+    case 'e':
+        if (opts->small_mode)
             break;
-        // Check for errors and write result to statusbar
-        case 'c':
-        {
-            char combined_solution[SUDOKU_LEN];
-            for (int i = 0; i < SUDOKU_LEN; i++) {
-                combined_solution[i] =
-                    sudoku->sudoku[i] == '0' ? sudoku->user[i] : sudoku->sudoku[i];
-            }
+        spec->editing_notes = !(spec->editing_notes);
+        sprintf(spec->statusbar, "%s Mode", spec->editing_notes ? "Note" : "Normal");
+
+        *redraw = true;
+        break;
+    case 'g':
+        input_go_to(spec);
+        break;
+    // Undo or redo the last edit and move to its cell
+    case 'u':
+    case 'r':
+    {
+        bool undo = key_press == 'u';
+        int cell = undo ? history_undo(spec->history, sudoku) : history_redo(spec->history, sudoku);
+        if (cell < 0) {
+            sprintf(spec->statusbar, "Nothing to %s", undo ? "undo" : "redo");
+        } else {
+            move_cursor_to(curs, opts->small_mode, cell % LINE_LEN, cell / LINE_LEN);
+            sprintf(spec->statusbar, "%s", undo ? "Undone" : "Redone");
+        }
 
-            if (check_validity(combined_solution))
-                sprintf(spec->statusbar, "%s", "Valid");
-            else
-                sprintf(spec->statusbar, "%s", "Invalid or not filled out");
+        *redraw = true;
+        break;
+    }
+    case 'v':
+    {
+        sprintf(spec->statusbar, "%s", "Highlight:");
+        draw(spec);
 
-            draw(spec);
+        spec->highlight = get_key();
+        if (spec->highlight < '1' || spec->highlight > '9') {
+            sprintf(spec->statusbar, "%s", "Cancelled");
+        } else {
+            sprintf(spec->statusbar, "%s%c", "Highlight: ", spec->highlight);
+        }
+
+        *redraw = true;
+        break;
+    }
+    // Exit; ask for confirmation
+    case 'q':
+        if (!status_bar_confirmation(spec))
             break;
+
+        return KEY_QUIT;
+    // Input numbers into the user sudoku field
+    default:
+    {
+        // Check if the key is a number (not zero) in aasci chars or 'x' and
+        // if the cursor is not an a field filled by the puzzle
+        int cell = curs->y * LINE_LEN + curs->x;
+
+        // Toggle the note fields (if in note mode)
+        if (spec->editing_notes) {
+            if (key_press >= '1' && key_press <= '9' &&
+                game_toggle_note(sudoku, spec->history, cell, CHNUM(key_press)))
+                *redraw = true;
+            // Check for numbers and place the number in user_nums
+        } else if (key_press >= '1' && key_press <= '9') {
+            if (game_insert(sudoku, spec->history, cell, CHNUM(key_press)))
+                *redraw = true;
         }
-        // Fill out sudoku; ask for confirmation first
-        case 'd':
-            if (!status_bar_confirmation(spec))
-                break;
+        // Check for x and clear the number (same as pressing space in
+        // the above conditional)
+        else if (key_press == 'x' || key_press == '0') {
+            if (game_erase(sudoku, spec->history, cell))
+                *redraw = true;
+        }
+        break;
+    }
+    }
 
-            char combined_solution[SUDOKU_LEN];
-            for (int i = 0; i < SUDOKU_LEN; i++) {
-                combined_solution[i] =
-                    sudoku->sudoku[i] == '0' ? sudoku->user[i] : sudoku->sudoku[i];
-            }
+    return KEY_CONTINUE;
+}
 
-            solve(combined_solution, false);
-            memcpy(sudoku->user, combined_solution, SUDOKU_LEN);
+/*
+** Draws the sudoku and processes input relating to modifying the sudoku,
+*changing something about the rendering or moving the cursor
+*/
+void mainloop(struct TSStruct *spec)
+{
+    spec->cursor->x = spec->cursor->y = 0;
 
-            draw(spec);
-            break;
-        // Enter edit mode
-        case 'e':
-            if (opts->small_mode)
-                break;
-            spec->editing_notes = !(spec->editing_notes);
-            sprintf(spec->statusbar, "%s Mode", spec->editing_notes ? "Note" : "Normal");
+    draw(spec);
 
-            draw(spec);
-            break;
-        case 'g':
-            input_go_to(spec);
-            break;
-        case 'v':
-        {
-            sprintf(spec->statusbar, "%s", "Highlight:");
-            draw(spec);
+    // Main loop: wait for keypress, then process it
+    while (handle_key_batch(spec, mainloop_key) == KEY_CONTINUE)
+        ;
 
-            spec->highlight = getch();
-            if (spec->highlight < '1' || spec->highlight > '9') {
-                sprintf(spec->statusbar, "%s", "Cancelled");
-            } else {
-                sprintf(spec->statusbar, "%s%c", "Highlight: ", spec->highlight);
-            }
+    spec->highlight = 0;
+}
 
-            draw(spec);
-            break;
-        }
-        // Exit; ask for confirmation
-        case 'q':
-            if (!status_bar_confirmation(spec))
-                break;
+// Set the directory of the save files to $HOME/.local/share/term-sudoku
+// (created if need be) unless '-d' gave one
+void set_default_dir(struct TSOpts *opts)
+{
+    if (strcmp(opts->dir, "") != 0)
+        return;
 
-            quit = true;
-            break;
-        // Input numbers into the user sudoku field
-        default:
-            // Check if the key is a number (not zero) in aasci chars or 'x' and
-            // if the cursor is not an a field filled by the puzzle
-
-            // Check if the field is empty in the puzzle
-            if (sudoku->sudoku[curs->y * LINE_LEN + curs->x] == '0') {
-                // Toggle the note fields (if in note mode)
-                if (spec->editing_notes) {
-                    if (key_press >= '1' && key_press <= '9') {
-                        // Access cursor location in array and add key_press for
-                        // appropriate number
-                        int *target = &sudoku->notes[((curs->y * LINE_LEN * LINE_LEN) +
-                                                     (curs->x * LINE_LEN)) +
-                                                     (key_press - '1')];
-                        *target = !*target;
-                        draw(spec);
-                    }
-                    // Check for numbers and place the number in user_nums
-                } else if (key_press >= '1' && key_press <= '9' &&
-                           sudoku->user[curs->y * LINE_LEN + curs->x] !=
-                               key_press) {
-                    sudoku->user[curs->y * LINE_LEN + curs->x] = key_press;
-                    // Clear notes off of target cell
-                    for (int i = 0; i < LINE_LEN; i++) {
-                        int *target = &sudoku->notes[((curs->y * LINE_LEN * LINE_LEN) +
-                                                     (curs->x * LINE_LEN)) + i];
-                        *target = 0;
-                    }
-                    draw(spec);
-                }
-                // Check for x and clear the number (same as pressing space in
-                // the above conditional)
-                else if ((key_press == 'x' || key_press == '0') &&
-                         sudoku->user[curs->y * LINE_LEN + curs->x] != '0') {
-                    sudoku->user[curs->y * LINE_LEN + curs->x] = '0';
-                    draw(spec);
-                }
+    const char *sharepath = ".local/share";
+    const char *appsharepath = ".local/share/term-sudoku";
+
+    // Get user home directory
+    struct passwd *pw = getpwuid(getuid());
+    char *home_dir = pw->pw_dir;
+
+    sprintf(opts->dir, "%s/%s", home_dir, sharepath);
+
+    // Create (if not already created) the term-sudoku directory in the
+    // .local/share directory
+    struct stat st;
+    if (stat(opts->dir, &st) != -1) {
+        sprintf(opts->dir, "%s/%s", home_dir, appsharepath);
+
+        // ~/.local/share exists but ~/.local/share/term-sudoku doesn't
+        if (stat(opts->dir, &st) == -1) {
+            if (mkdir(opts->dir, 0777) == -1) {
+                finish_with_errno("Creating directory %s", opts->dir);
             }
-            break;
         }
+    } else {
+        // Fallback to current working directory, since ~/.local/share doesn't exist
+        sprintf(opts->dir, ".");
     }
+}
 
-    spec->highlight = 0;
+// Translate the argument of '--difficulty' into a grade
+bool parse_difficulty(const char *name, enum SudokuGrade *grade)
+{
+    for (int i = SUDOKU_GRADE_EASY; i < SUDOKU_GRADE_COUNT; i++) {
+        if (strcmp(name, sudoku_grade_name(i)) == 0) {
+            *grade = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Translate the argument of '--shard', "I/N" with I counted from 0
+bool parse_shard(const char *arg, int *index, int *count)
+{
+    char trailing;
+    return sscanf(arg, "%d/%d%c", index, count, &trailing) == 2 && *count > 0 && *index >= 0 &&
+           *index < *count;
 }
 
 int main(int argc, char **argv)
 {
     struct TSOpts opts = {
         .gen_visual = false,
+        .gen_fps = FPS_DEFAULT,
+        .replay_speed = 0,
         .own_sudoku = false,
-        .attempts = ATTEMPTS_DEFAULT,
+        .attempts = SUDOKU_ATTEMPTS_DEFAULT,
+        .time_budget = 0,
+        .threads = 1,
+        .speculate = 1,
         .from_file = false,
         .ask_confirmation = true,
         .small_mode = false,
+        .backend = RENDER_NCURSES,
+        .seed = 0,
+        .have_seed = false,
+        .record_keys = NULL,
+        .replay_keys = NULL,
+        .import_file = NULL,
+        .serve_path = NULL,
+        .shard_index = 0,
+        .shard_count = 0,
+        .puzzles = 0,
+        .count_solutions = false,
+        .count_limit = 0,
+        .fill_grids = 0,
+        .stats = STATS_OFF,
+        .save_history = false,
+        .difficulty = SUDOKU_GRADE_NONE,
+        .minimal = false,
+        .variant = SUDOKU_VARIANT_STANDARD,
     };
     opts.dir[0] = '\0';
 
+    // Options without a short form
+    enum {
+        OPT_SERVE = 256,
+        OPT_TIME_BUDGET,
+        OPT_STATS,
+        OPT_SPECULATE,
+        OPT_SAVE_HISTORY,
+        OPT_DIFFICULTY,
+        OPT_MINIMAL,
+        OPT_VARIANT,
+        OPT_SHARD,
+        OPT_PUZZLES,
+        OPT_COUNT_SOLUTIONS,
+        OPT_FILL_GRIDS,
+    };
+    const struct option long_opts[] = {
+        { "serve", required_argument, NULL, OPT_SERVE },
+        { "time-budget", required_argument, NULL, OPT_TIME_BUDGET },
+        { "stats", optional_argument, NULL, OPT_STATS },
+        { "speculate", required_argument, NULL, OPT_SPECULATE },
+        { "save-history", no_argument, NULL, OPT_SAVE_HISTORY },
+        { "difficulty", required_argument, NULL, OPT_DIFFICULTY },
+        { "minimal", no_argument, NULL, OPT_MINIMAL },
+        { "variant", required_argument, NULL, OPT_VARIANT },
+        { "shard", required_argument, NULL, OPT_SHARD },
+        { "puzzles", required_argument, NULL, OPT_PUZZLES },
+        { "count-solutions", optional_argument, NULL, OPT_COUNT_SOLUTIONS },
+        { "fill-grids", required_argument, NULL, OPT_FILL_GRIDS },
+        { "seed", required_argument, NULL, 'S' },
+        { 0 },
+    };
+
     // Handle command line input with getopt
     int flag;
-    while ((flag = getopt(argc, argv, "hsvfecd:n:")) != -1) {
+    while ((flag = getopt_long(argc, argv, "hsvfecd:n:j:F:r:b:S:K:k:", long_opts, NULL)) != -1) {
         switch (flag) {
         case 'h':
             printf("term-sudoku Copyright (C) 2024 eyeofcthulhu\n\n"
-                   "usage: term-sudoku [-hsvfec] [-d DIR] [-n NUMBER]\n\n"
+                   "usage: term-sudoku [-hsvfc] [-e [FILE]] [-d DIR] [-n NUMBER] [-j THREADS] [-F FPS] "
+                   "[-r SPEED] [-b BACKEND] [-S SEED] [-K FILE] [-k FILE]\n"
+                   "                   [--time-budget MS] [--speculate K] [--difficulty LEVEL] [--stats[=FORMAT]]\n"
+                   "                   [--minimal] [--variant NAME] [--save-history]\n"
+                   "       term-sudoku --serve SOCKET [-d DIR] [-n NUMBER] [-j THREADS] [-S SEED] [--time-budget MS] "
+                   "[--difficulty LEVEL] [--minimal]\n"
+                   "                   [--variant NAME]\n"
+                   "       term-sudoku --puzzles TOTAL [--shard I/N] -S SEED [-n NUMBER] [-j THREADS] "
+                   "[--speculate K] [--difficulty LEVEL]\n"
+                   "                   [--minimal] [--variant NAME] [--stats[=FORMAT]]\n"
+                   "       term-sudoku --count-solutions[=LIMIT] [--variant NAME] [--stats[=FORMAT]] [FILE...]\n"
+                   "       term-sudoku --fill-grids COUNT [-S SEED] [--variant NAME] [--stats[=FORMAT]]\n\n"
                    "flags:\n"
                    "-h: display this information\n"
                    "-s: small mode (disables noting numbers)\n"
                    "-v: generate the Sudoku visually\n"
                    "-f: list save games and use a selected file as the Sudoku\n"
-                   "-e: enter your own Sudoku\n"
+                   "-e: enter your own Sudoku, starting from the puzzle in FILE "
+                   "('-' for stdin) if given\n"
                    "-c: do not ask for confirmation when trying to exit, "
                    "solve, etc.\n"
                    "-d: DIR: specify directory where save files are and should "
                    "be saved\n"
-                   "-n: NUMBER: numbers to try and remove (default: %d)\n\n"
+                   "-n: NUMBER: numbers to try and remove (default: %d)\n"
+                   "-j: THREADS: threads for checking that a solution is unique "
+                   "(default: 1)\n"
+                   "-F: FPS: frame rate of the visual generation (default: "
+                   "%d)\n"
+                   "-r: SPEED: replay the generation afterwards at SPEED steps "
+                   "per second (implies -v)\n"
+                   "-b: BACKEND: how to draw: ncurses (default), ansi (raw escape "
+                   "sequences) or null (draw nothing, read keys from stdin)\n"
+                   "-S, --seed: SEED: seed for generating the Sudoku\n"
+                   "-K: FILE: record the keys of this session to FILE\n"
+                   "-k: FILE: replay the keys recorded in FILE without drawing "
+                   "to the terminal and report how long they took\n"
+                   "--serve: SOCKET: answer GEN, SOLVE, COUNT and VALIDATE "
+                   "requests and host games (NEW, PUT, UNDO, ...) on the UNIX domain socket SOCKET\n"
+                   "--puzzles: TOTAL: print a sequence of TOTAL puzzles made "
+                   "from SEED instead of playing, with their grades\n"
+                   "--shard: I/N: print only the puzzles of the sequence whose "
+                   "index modulo N is I (0 to N-1); sudoku-merge combines the shards\n"
+                   "--count-solutions: LIMIT: print the exact number of solutions, "
+                   "up to LIMIT if given, of each puzzle in the FILEs (stdin if none), "
+                   "one per line\n"
+                   "--fill-grids: COUNT: print COUNT random complete grids, one per line\n"
+                   "--time-budget: MS: remove numbers for MS milliseconds "
+                   "instead of -n attempts\n"
+                   "--speculate: K: try to remove K numbers at once, on the "
+                   "threads of -j\n"
+                   "--difficulty: LEVEL: generate an easy, hard or fiendish "
+                   "Sudoku\n"
+                   "--minimal: remove numbers until none can go without "
+                   "losing the unique solution\n"
+                   "--variant: NAME: play by the rules of standard (default), x, "
+                   "jigsaw, windoku, anti-king or anti-knight Sudoku\n"
+                   "--stats: FORMAT: show counters of the solver and print them "
+                   "on exit as text (default) or json, also after --puzzles, "
+                   "--count-solutions and --fill-grids\n"
+                   "--save-history: keep the undo history in save files\n\n"
                    "controls:\n"
                    "%s",
-                   ATTEMPTS_DEFAULT, controls_default);
+                   SUDOKU_ATTEMPTS_DEFAULT, FPS_DEFAULT, controls_default);
             return 0;
         case 'v':
             opts.gen_visual = true;
@@ -528,7 +1020,91 @@ int main(int argc, char **argv)
         case 'n':
             opts.attempts = strtol(optarg, NULL, 10);
             if (opts.attempts <= 0)
-                opts.attempts = ATTEMPTS_DEFAULT;
+                opts.attempts = SUDOKU_ATTEMPTS_DEFAULT;
+            break;
+        case 'j':
+            opts.threads = strtol(optarg, NULL, 10);
+            if (opts.threads <= 0)
+                opts.threads = 1;
+            break;
+        case 'F':
+            opts.gen_fps = strtol(optarg, NULL, 10);
+            if (opts.gen_fps <= 0)
+                opts.gen_fps = FPS_DEFAULT;
+            break;
+        case 'r':
+            opts.replay_speed = strtol(optarg, NULL, 10);
+            if (opts.replay_speed > 0)
+                opts.gen_visual = true;
+            break;
+        case 'b':
+            if (!parse_backend(optarg, &opts.backend)) {
+                fprintf(stderr, "Unknown backend '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'S':
+            opts.seed = strtoull(optarg, NULL, 10);
+            opts.have_seed = true;
+            break;
+        case 'K':
+            opts.record_keys = optarg;
+            break;
+        case 'k':
+            opts.replay_keys = optarg;
+            break;
+        case OPT_SERVE:
+            opts.serve_path = optarg;
+            break;
+        case OPT_TIME_BUDGET:
+            opts.time_budget = strtoul(optarg, NULL, 10);
+            break;
+        case OPT_SPECULATE:
+            opts.speculate = strtol(optarg, NULL, 10);
+            break;
+        case OPT_DIFFICULTY:
+            if (!parse_difficulty(optarg, &opts.difficulty)) {
+                fprintf(stderr, "Unknown difficulty '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_MINIMAL:
+            opts.minimal = true;
+            break;
+        case OPT_VARIANT:
+            if (!board_parse_variant(optarg, &opts.variant)) {
+                fprintf(stderr, "Unknown variant '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_SHARD:
+            if (!parse_shard(optarg, &opts.shard_index, &opts.shard_count)) {
+                fprintf(stderr, "Invalid shard '%s', expected I/N with 0 <= I < N\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_PUZZLES:
+            opts.puzzles = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_FILL_GRIDS:
+            opts.fill_grids = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_COUNT_SOLUTIONS:
+            opts.count_solutions = true;
+            opts.count_limit = optarg != NULL ? strtoull(optarg, NULL, 10) : 0;
+            break;
+        case OPT_SAVE_HISTORY:
+            opts.save_history = true;
+            break;
+        case OPT_STATS:
+#ifndef SUDOKU_STATS
+            fprintf(stderr, "term-sudoku was built without statistics (SUDOKU_STATS)\n");
+            return 1;
+#endif
+            if (!stats_parse_format(optarg, &opts.stats)) {
+                fprintf(stderr, "Unknown statistics format: %s\n", optarg);
+                return 1;
+            }
             break;
         case 'd':
             sprintf(opts.dir, "%s", optarg);
@@ -548,71 +1124,117 @@ int main(int argc, char **argv)
         }
     }
 
-    // on Ctrl+C and segfault, exit ncurses gracefully
-    signal(SIGINT, finish);
-    signal(SIGSEGV, finish);
+    // The puzzle to start from with '-e'
+    char imported[SUDOKU_LEN];
+    if (opts.own_sudoku && optind < argc) {
+        opts.import_file = argv[optind];
+        if (!read_sudoku_file(opts.import_file, imported)) {
+            fprintf(stderr, "Reading puzzle from %s: %s\n", opts.import_file,
+                    errno == EINVAL ? "not a puzzle of 81 cells" : strerror(errno));
+            return 1;
+        }
+    }
 
     // Seed random
+    if (!opts.have_seed) {
 #ifdef __linux__
-    // If running Linux, seed with /dev/urandom
-    // bytes
-    unsigned int seed;
-    if (getrandom(&seed, sizeof(seed), 0) == -1) {
-        perror("getrandom");
-        srand(time(NULL));
-    } else {
-        srand(seed);
-    }
+        // If running Linux, seed with /dev/urandom
+        // bytes
+        if (getrandom(&opts.seed, sizeof(opts.seed), 0) == -1) {
+            perror("getrandom");
+            opts.seed = time(NULL);
+        }
 #else
-    srand(time(NULL));
+        opts.seed = time(NULL);
 #endif
+    }
 
-    // Set dir as $HOME/.local/share
-    if (strcmp(opts.dir, "") == 0) {
-        const char *sharepath = ".local/share";
-        const char *appsharepath = ".local/share/term-sudoku";
+    if (opts.serve_path != NULL) {
+        // Every worker counts on a solver of its own, for as long as it runs
+        if (opts.stats != STATS_OFF) {
+            fprintf(stderr, "--stats cannot be used with --serve\n");
+            return 1;
+        }
+        set_default_dir(&opts);
+        return serve(&opts, opts.serve_path, opts.seed);
+    }
 
-        // Get user home directory
-        struct passwd *pw = getpwuid(getuid());
-        char *home_dir = pw->pw_dir;
+    if (opts.count_solutions)
+        return count_solutions(&opts, argv + optind, argc - optind);
+    if (opts.fill_grids > 0)
+        return fill_grids(&opts);
 
-        sprintf(opts.dir, "%s/%s", home_dir, sharepath);
+    // Shards have to make the same sequence, whatever machine runs them
+    if (opts.shard_count > 0 || opts.puzzles > 0) {
+        if (opts.puzzles == 0) {
+            fprintf(stderr, "--shard needs --puzzles TOTAL\n");
+            return 1;
+        }
+        if (opts.shard_count > 1 && !opts.have_seed) {
+            fprintf(stderr, "--shard needs a seed (-S or --seed) shared by all shards\n");
+            return 1;
+        }
+        if (opts.time_budget > 0) {
+            fprintf(stderr, "--time-budget makes the puzzles depend on the machine, "
+                            "it cannot be used with --puzzles\n");
+            return 1;
+        }
+        if (opts.shard_count == 0)
+            opts.shard_count = 1;
+        return shard_generate(&opts);
+    }
 
-        // Create (if not already created) the term-sudoku directory in the
-        // .local/share directory
-        struct stat st;
-        if (stat(opts.dir, &st) != -1) {
-            sprintf(opts.dir, "%s/%s", home_dir, appsharepath);
+    // on Ctrl+C and segfault, exit ncurses gracefully
+    signal(SIGINT, finish);
+    signal(SIGSEGV, finish);
 
-            // ~/.local/share exists but ~/.local/share/term-sudoku doesn't
-            if (stat(opts.dir, &st) == -1) {
-                if (mkdir(opts.dir, 0777) == -1) {
-                    finish_with_errno("Creating directory %s", opts.dir);
-                }
-            }
-        } else {
-            // Fallback to current working directory, since ~/.local/share doesn't exist
-            sprintf(opts.dir, ".");
-        }
+    struct SudokuCtx *ctx = sudoku_ctx_new();
+    if (ctx == NULL) {
+        perror("Allocating solver");
+        return 1;
+    }
+    sudoku_ctx_seed(ctx, opts.seed);
+    sudoku_ctx_set_threads(ctx, opts.threads);
+    sudoku_ctx_set_speculation(ctx, opts.speculate);
+    sudoku_ctx_set_difficulty(ctx, opts.difficulty);
+    sudoku_ctx_set_minimal(ctx, opts.minimal);
+    sudoku_ctx_set_variant(ctx, opts.variant);
+    if (opts.stats != STATS_OFF)
+        stats_report_at_exit(ctx, opts.stats);
+
+    if (opts.record_keys != NULL && !keytrace_record_open(opts.record_keys)) {
+        perror(opts.record_keys);
+        return 1;
     }
+    if (opts.replay_keys != NULL && !keytrace_replay_open(opts.replay_keys)) {
+        perror(opts.replay_keys);
+        return 1;
+    }
+
+    set_default_dir(&opts);
 
     struct SudokuSpec sudoku;
+    struct History history;
     struct Cursor cursor;
+    history_init(&history);
 
     struct TSStruct spec = {
         .opts = &opts,
         .sudoku = &sudoku,
+        .history = &history,
+        .ctx = ctx,
         .cursor = &cursor,
         .highlight = 0,
         .controls = controls_default,
     };
     memset(spec.statusbar, '\0', sizeof(spec.statusbar));
+    memset(spec.debugline, '\0', sizeof(spec.debugline));
 
     spec.opts = &opts;
     spec.sudoku = &sudoku;
     spec.cursor = &cursor;
 
-    init_ncurses();
+    init_renderer(opts.backend);
 
     if (opts.gen_visual)
         init_visual_generator(&spec);
@@ -627,11 +1249,12 @@ int main(int argc, char **argv)
     }
     // User enters a new sudoku and edits it in mainloop() if successful
     else if (opts.own_sudoku) {
-        if (own_sudoku_view(&spec))
+        if (own_sudoku_view(&spec, opts.import_file != NULL ? imported : NULL))
             mainloop(&spec);
         // Not own_sudoku nor from_file: generate new sudoku
     } else {
-        new_sudoku(&spec);
+        if (!new_sudoku(&spec))
+            finish_with_err_msg("Generation cancelled\n");
         mainloop(&spec);
     }
 
@@ -18,6 +18,12 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #pragma once
 
+#include "board.h"
+#include "checker.h"
+#include "history.h"
+#include "stats.h"
+#include "sudoku.h"
+
 #include <stdbool.h>
 
 #ifdef __linux__
@@ -26,31 +32,77 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define PATH_MAX 4096
 #endif
 
-#define LINE_LEN 9
-#define SUDOKU_LEN 81
-#define SOLUTION_SUM ((((LINE_LEN*LINE_LEN)+LINE_LEN)/2)*LINE_LEN) // sum of all numbers in a correct solution
-#define ATTEMPTS_DEFAULT 5
+#define FPS_DEFAULT 30
 #define STR_LEN 80
 #define PUZZLE_OFFSET 1
 
+enum RenderBackend {
+    RENDER_NCURSES,
+    RENDER_ANSI,
+    RENDER_NULL,
+};
+
 struct TSOpts {
     bool gen_visual;
+    int gen_fps;
+    int replay_speed;
     bool own_sudoku;
     int attempts;
+    // Milliseconds to spend removing clues, 0 to use up 'attempts' instead
+    unsigned time_budget;
+    // Threads for counting solutions
+    int threads;
+    // Clues to try and remove at once
+    int speculate;
+    // Grade to generate puzzles of, SUDOKU_GRADE_NONE for any
+    enum SudokuGrade difficulty;
+    // Remove numbers until none can go
+    bool minimal;
+    // Rules of new puzzles
+    enum SudokuVariant variant;
     char dir[PATH_MAX];
     bool from_file;
     bool ask_confirmation;
     bool small_mode;
     char filename[STR_LEN];
+    enum RenderBackend backend;
+    unsigned long long seed;
+    bool have_seed;
+    const char *record_keys;
+    const char *replay_keys;
+    const char *import_file;
+    const char *serve_path;
+    // Write shard 'shard_index' of 'shard_count' of a sequence of 'puzzles'
+    // puzzles to stdout instead of playing, see shard_generate()
+    int shard_index;
+    int shard_count;
+    unsigned long long puzzles;
+    // Count the solutions of puzzles instead of playing, up to 'count_limit'
+    // (0 for no limit), see count_solutions()
+    bool count_solutions;
+    unsigned long long count_limit;
+    // Write this many complete grids to stdout instead of playing
+    unsigned long long fill_grids;
+    enum StatsFormat stats;
+    // Write the undo history into save files
+    bool save_history;
 };
 
 struct TSStruct {
     const char *controls;
     char statusbar[STR_LEN];
+    // Counters of the solver, shown under the statusbar with '--stats'
+    char debugline[STR_LEN];
     int highlight;
     bool editing_notes;
     struct SudokuSpec *sudoku;
+    struct History *history;
+    struct SudokuCtx *ctx;
     struct TSOpts *opts;
     struct Cursor *cursor;
+    // Counts the solutions of the puzzle being entered, NULL while playing
+    struct Checker *checker;
+    // What it found out last, its impossible clues are drawn in red
+    struct CheckResult check;
 };
 
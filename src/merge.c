@@ -0,0 +1,269 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// sudoku-merge: combine the files written by 'term-sudoku --shard I/N' into
+// one, ordered by the index of the puzzles in the sequence. Shards that were
+// run twice and puzzles that came out the same twice are only written once,
+// and shards with puzzles missing are named so that they can be run again.
+
+#include "shard.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Entry {
+    unsigned long long index;
+    char puzzle[SUDOKU_LEN];
+    // Empty for shards written before the grade was
+    char grade[SHARD_GRADE_LEN];
+    bool duplicate;
+};
+
+struct Merge {
+    // The header of the first shard without "shard I/N", all others must match
+    char options[SHARD_HEADER_LEN];
+    int shard_count;
+    unsigned long long puzzles;
+    struct Entry *entries;
+    size_t len;
+    size_t cap;
+};
+
+static bool add_entry(struct Merge *m, unsigned long long index, const char *puzzle, const char *grade)
+{
+    if (m->len == m->cap) {
+        size_t cap = m->cap > 0 ? m->cap * 2 : 1024;
+        struct Entry *entries = realloc(m->entries, cap * sizeof(*entries));
+        if (entries == NULL)
+            return false;
+        m->entries = entries;
+        m->cap = cap;
+    }
+
+    struct Entry *entry = &m->entries[m->len++];
+    entry->index = index;
+    memcpy(entry->puzzle, puzzle, SUDOKU_LEN);
+    snprintf(entry->grade, sizeof(entry->grade), "%s", grade);
+    entry->duplicate = false;
+    return true;
+}
+
+// Read what follows the puzzle on a line of a shard: nothing, or its grade
+static bool read_grade(const char *text, char *grade)
+{
+    if (text[0] == '\n' || text[0] == '\0')
+        return true;
+
+    int end = 0;
+    return text[0] == ' ' &&
+           sscanf(text, " %15[a-z] %n", grade, &end) == 1 && text[end] == '\0';
+}
+
+// Read the puzzles of one shard file, false with a message if it is not one or
+// belongs to another sequence
+static bool read_shard(struct Merge *m, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char line[SHARD_HEADER_LEN];
+    int shard, count, options_at;
+    if (fgets(line, sizeof(line), file) == NULL ||
+        sscanf(line, "# shard %d/%d %n", &shard, &count, &options_at) != 2 || count <= 0 ||
+        shard < 0 || shard >= count) {
+        fprintf(stderr, "%s: not written by term-sudoku --shard\n", path);
+        fclose(file);
+        return false;
+    }
+
+    const char *options = line + options_at;
+    if (m->shard_count == 0) {
+        snprintf(m->options, sizeof(m->options), "%s", options);
+        m->shard_count = count;
+        sscanf(options, "seed %*u puzzles %llu", &m->puzzles);
+    } else if (count != m->shard_count || strcmp(options, m->options) != 0) {
+        fprintf(stderr, "%s: shard of another sequence (%d shards, %.*s)\n", path, count,
+                (int)strcspn(options, "\n"), options);
+        fclose(file);
+        return false;
+    }
+
+    bool ok = true;
+    for (int lineno = 2; ok && fgets(line, sizeof(line), file) != NULL; lineno++) {
+        unsigned long long index;
+        int puzzle_at, end = 0;
+        char grade[SHARD_GRADE_LEN] = "";
+        if (sscanf(line, "%llu %n%*81[0-9]%n", &index, &puzzle_at, &end) != 1 ||
+            end - puzzle_at != SUDOKU_LEN || !read_grade(line + end, grade)) {
+            fprintf(stderr, "%s:%d: not a puzzle\n", path, lineno);
+            ok = false;
+        } else if (index >= m->puzzles || index % count != (unsigned long long)shard) {
+            fprintf(stderr, "%s:%d: puzzle %llu is not in shard %d/%d\n", path, lineno, index,
+                    shard, count);
+            ok = false;
+        } else if (!add_entry(m, index, line + puzzle_at, grade)) {
+            perror("Reading puzzles");
+            ok = false;
+        }
+    }
+
+    if (ok && ferror(file)) {
+        perror(path);
+        ok = false;
+    }
+    fclose(file);
+    return ok;
+}
+
+static int compare_index(const void *a, const void *b)
+{
+    const struct Entry *x = a, *y = b;
+    if (x->index != y->index)
+        return x->index < y->index ? -1 : 1;
+    return memcmp(x->puzzle, y->puzzle, SUDOKU_LEN);
+}
+
+static int compare_puzzle(const void *a, const void *b)
+{
+    const struct Entry *const *x = a, *const *y = b;
+    int cmp = memcmp((*x)->puzzle, (*y)->puzzle, SUDOKU_LEN);
+    if (cmp != 0)
+        return cmp;
+    return (*x)->index < (*y)->index ? -1 : (*x)->index > (*y)->index;
+}
+
+// Sort the puzzles by index and drop those read twice, false if two shards
+// disagree on a puzzle
+static bool sort_entries(struct Merge *m)
+{
+    qsort(m->entries, m->len, sizeof(*m->entries), compare_index);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < m->len; i++) {
+        if (kept > 0 && m->entries[kept - 1].index == m->entries[i].index) {
+            if (memcmp(m->entries[kept - 1].puzzle, m->entries[i].puzzle, SUDOKU_LEN) != 0) {
+                fprintf(stderr, "Puzzle %llu differs between runs of its shard\n",
+                        m->entries[i].index);
+                return false;
+            }
+            continue;
+        }
+        m->entries[kept++] = m->entries[i];
+    }
+    m->len = kept;
+    return true;
+}
+
+// Mark every puzzle that already came up at a lower index, returns how many
+static size_t mark_duplicates(struct Merge *m)
+{
+    struct Entry **by_puzzle = malloc(m->len * sizeof(*by_puzzle));
+    if (by_puzzle == NULL && m->len > 0) {
+        perror("Merging puzzles");
+        exit(1);
+    }
+    for (size_t i = 0; i < m->len; i++)
+        by_puzzle[i] = &m->entries[i];
+    qsort(by_puzzle, m->len, sizeof(*by_puzzle), compare_puzzle);
+
+    size_t duplicates = 0;
+    for (size_t i = 1; i < m->len; i++) {
+        if (memcmp(by_puzzle[i - 1]->puzzle, by_puzzle[i]->puzzle, SUDOKU_LEN) == 0) {
+            by_puzzle[i]->duplicate = true;
+            duplicates++;
+        }
+    }
+
+    free(by_puzzle);
+    return duplicates;
+}
+
+// Name the shards that are missing puzzles, returns how many puzzles are
+static unsigned long long report_missing(const struct Merge *m)
+{
+    unsigned long long missing = 0;
+    unsigned long long *found = calloc(m->shard_count, sizeof(*found));
+    if (found == NULL) {
+        perror("Merging puzzles");
+        exit(1);
+    }
+    for (size_t i = 0; i < m->len; i++)
+        found[m->entries[i].index % m->shard_count]++;
+
+    for (int shard = 0; shard < m->shard_count; shard++) {
+        unsigned long long expected = 0;
+        if ((unsigned long long)shard < m->puzzles)
+            expected = (m->puzzles - shard + m->shard_count - 1) / m->shard_count;
+
+        if (found[shard] < expected) {
+            fprintf(stderr, "Shard %d/%d is missing %llu of %llu puzzles\n", shard,
+                    m->shard_count, expected - found[shard], expected);
+            missing += expected - found[shard];
+        }
+    }
+
+    free(found);
+    return missing;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || strcmp(argv[1], "-h") == 0) {
+        printf("usage: sudoku-merge SHARD...\n\n"
+               "Combine the output of 'term-sudoku --shard I/N' into one sequence on\n"
+               "stdout, ordered and without duplicates. Fails if a shard is missing\n"
+               "puzzles, naming it.\n");
+        return argc < 2;
+    }
+
+    struct Merge m = { 0 };
+    for (int i = 1; i < argc; i++) {
+        if (!read_shard(&m, argv[i]))
+            return 1;
+    }
+    if (!sort_entries(&m))
+        return 1;
+    size_t duplicates = mark_duplicates(&m);
+
+    printf("# %s", m.options);
+    for (size_t i = 0; i < m.len; i++) {
+        const struct Entry *entry = &m.entries[i];
+        if (entry->duplicate)
+            continue;
+        if (entry->grade[0] != '\0')
+            printf("%llu %.*s %s\n", entry->index, SUDOKU_LEN, entry->puzzle, entry->grade);
+        else
+            printf("%llu %.*s\n", entry->index, SUDOKU_LEN, entry->puzzle);
+    }
+    if (fflush(stdout) != 0) {
+        perror("Writing puzzles");
+        return 1;
+    }
+
+    unsigned long long missing = report_missing(&m);
+    fprintf(stderr, "%zu puzzles, %zu duplicates dropped, %llu missing\n", m.len - duplicates,
+            duplicates, missing);
+    free(m.entries);
+
+    return missing > 0;
+}
@@ -16,33 +16,38 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
-#include "ncurses_render.h"
+#include "render.h"
 
+#include "board.h"
 #include "main.h"
 #include "sudoku.h"
 #include "util.h"
 
-#include <assert.h>
 #include <curses.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <unistd.h>
 
 void draw_sudokus(const struct TSStruct *spec);
 void read_notes(const struct SudokuSpec *spec);
-void draw_border(bool small_mode);
+static void ncurses_move_cursor(const struct Cursor *curs, bool small_mode);
+void draw_border(enum SudokuVariant variant, bool small_mode);
+void build_border_layer(WINDOW *layer, enum SudokuVariant variant, bool small_mode);
 void read_sudoku(const struct TSStruct *spec, const char *sudoku, int color_mode, int color_mode_highlight);
 
-static struct TSStruct *vis_gen_spec;
-
-// 10 milliseconds
-#define VISUAL_SLEEP 10000000
-const struct timespec sleep_request = {0, VISUAL_SLEEP};
+// Off-screen copy of the static border, one for normal and one for small mode
+struct BorderLayer {
+    WINDOW *win;
+    int rows;
+    int cols;
+    // The variant the border was built for
+    enum SudokuVariant variant;
+};
+static struct BorderLayer border_layers[2];
 
 // curses init logic
-void init_ncurses()
+static void ncurses_init(void)
 {
     // init
     initscr();
@@ -63,13 +68,21 @@ void init_ncurses()
     init_pair(3, COLOR_YELLOW, COLOR_BLACK);
     init_pair(4, COLOR_BLACK, COLOR_WHITE);
     init_pair(5, COLOR_BLACK, COLOR_BLUE);
+    init_pair(6, COLOR_RED, COLOR_BLACK);
+}
+
+static void ncurses_finish(void)
+{
+    endwin();
 }
 
 #define CONTROL_BUF_SZ 256
 // Draws everything
-void draw(const struct TSStruct *spec)
+static void ncurses_draw(const struct TSStruct *spec)
 {
     erase();
+    // The border layer is copied destructively, so it has to come first
+    draw_border(spec->sudoku->variant, spec->opts->small_mode);
     if (!spec->opts->small_mode)
         read_notes(spec->sudoku);
     draw_sudokus(spec);
@@ -79,6 +92,7 @@ void draw(const struct TSStruct *spec)
     int string_x = spec->opts->small_mode ? 0 : (LINE_LEN * 4) + 3 + PUZZLE_OFFSET;
 
     mvaddstr(string_y, string_x, spec->statusbar);
+    mvaddstr(string_y + 1, string_x, spec->debugline);
     string_y += 2;
 
     // Draw each line at string_x, next to the puzzle
@@ -91,93 +105,123 @@ void draw(const struct TSStruct *spec)
         }
 
         mvprintw(string_y + 1, string_x, "--- %s ---", spec->editing_notes ? "Note" : "Normal");
+        if (spec->sudoku->variant != SUDOKU_VARIANT_STANDARD)
+            printw(" %s", sudoku_variant_name(spec->sudoku->variant));
     } else {
         mvaddstr(string_y, string_x, spec->controls);
     }
 
-    move_cursor(spec->cursor, spec->opts->small_mode);
+    // Also sends the screen to the terminal
+    ncurses_move_cursor(spec->cursor, spec->opts->small_mode);
 }
 
-void init_visual_generator(struct TSStruct *spec)
+static void ncurses_draw_visual(const struct TSStruct *spec, const char *sudoku_to_display)
 {
-    vis_gen_spec = spec;
+    erase();
+    draw_border(spec->sudoku->variant, spec->opts->small_mode);
+    read_sudoku(spec, sudoku_to_display, 1, 4);
+    wnoutrefresh(stdscr);
+    doupdate();
 }
 
-// For -v flag: show the generating process
-void generate_visually(const char *sudoku_to_display)
+static void ncurses_draw_fileview(const char *controls, const char *dir, char **items, int count, int position)
 {
-    assert(vis_gen_spec != NULL);
+    const int filestart = 4;
 
     erase();
-    draw_border(vis_gen_spec->opts->small_mode);
-    read_sudoku(vis_gen_spec, sudoku_to_display, 1, 4);
-    refresh();
-    nanosleep(&sleep_request, NULL);
+
+    mvprintw(0, 0, "%s", controls);
+
+    mvprintw(2, 0, "%s", dir);
+
+    for (int j = 0; j < count; j++)
+        mvprintw(j + filestart, 4, "  %s\n", items[j]);
+
+    // Asteriks as cursor for file selection
+    mvaddch(position + filestart, 4, '*');
+
+    wnoutrefresh(stdscr);
+    doupdate();
 }
 
-// Draws the 'skeleton' of the sudoku:
+// Compose the cached border layer for the current mode onto the screen, the
+// layer is built only once per mode and variant since the border never changes
+void draw_border(enum SudokuVariant variant, bool small_mode)
+{
+    struct BorderLayer *layer = &border_layers[small_mode];
+
+    if (layer->win != NULL && layer->variant != variant) {
+        delwin(layer->win);
+        layer->win = NULL;
+    }
+    if (layer->win == NULL) {
+        layer->rows = small_mode ? LINE_LEN + 5 : (LINE_LEN * 4) + 2;
+        layer->cols = layer->rows;
+        layer->win = newpad(layer->rows, layer->cols);
+        if (layer->win == NULL)
+            finish_with_err_msg("Could not allocate border layer\n");
+        layer->variant = variant;
+        build_border_layer(layer->win, variant, small_mode);
+    }
+
+    // Clip to the screen, copywin() refuses to copy outside of it
+    int max_row = (layer->rows < LINES ? layer->rows : LINES) - 1;
+    int max_col = (layer->cols < COLS ? layer->cols : COLS) - 1;
+    copywin(layer->win, stdscr, 0, 0, 0, 0, max_row, max_col, false);
+}
+
+// Draws the 'skeleton' of the sudoku into an off-screen layer:
 // Number indicators on the sides, borders for large and small mode,
-// different colors for indicating which is a block border
-void draw_border(bool small_mode)
+// different colors for indicating which is a region border, and the marks
+// of the variant in the cells
+void build_border_layer(WINDOW *layer, enum SudokuVariant variant, bool small_mode)
 {
+    wattron(layer, COLOR_PAIR(3));
+    for (int i = 0; i < SUDOKU_LEN; i++) {
+        char marker = cell_marker(variant, i, small_mode);
+        if (marker != 0)
+            mvwaddch(layer, CELL_ROW(i / LINE_LEN, small_mode), CELL_COL(i % LINE_LEN, small_mode), marker);
+    }
+    wattroff(layer, COLOR_PAIR(3));
+
     if (!small_mode) {
-        for (int y = 0; y < LINE_LEN + 1; y++) {
-            // On every third vertical line, add colored seperator
-            if (y % 3 == 0)
-                attron(COLOR_PAIR(3));
-            else
-                attron(COLOR_PAIR(1));
-            for (int i = 0; i < (LINE_LEN * 3) + LINE_LEN + 1; i++) {
-                mvaddch((y * 4) + PUZZLE_OFFSET, i + PUZZLE_OFFSET, '-');
-            }
-        }
-        for (int x = 0; x < LINE_LEN + 1; x++) {
-            // On every third character, add a pipe
-            if (x % 3 == 0)
-                attron(COLOR_PAIR(3));
-            else
-                attron(COLOR_PAIR(1));
-            for (int i = 1; i < LINE_LEN * 3 + LINE_LEN; i++) {
-                mvaddch(i + PUZZLE_OFFSET, (x * 4) + PUZZLE_OFFSET, '|');
+        for (int y = 0; y < BORDER_LEN; y++) {
+            for (int x = 0; x < BORDER_LEN; x++) {
+                int color;
+                char c = border_char(variant, y, x, &color);
+                if (c == 0)
+                    continue;
+                wattron(layer, COLOR_PAIR(color));
+                mvwaddch(layer, y + PUZZLE_OFFSET, x + PUZZLE_OFFSET, c);
             }
         }
-        // Add horizontal seperators that overlay the others for indicating cube
-        // borders
-        attron(COLOR_PAIR(3));
-        for (int i = 0; i < (LINE_LEN * 3) + 10; i++) {
-            mvaddch((LINE_LEN * 3) + (3 * 3) + PUZZLE_OFFSET, i + PUZZLE_OFFSET,
-                    '-');
-            mvaddch((LINE_LEN * 2) + (3 * 2) + PUZZLE_OFFSET, i + PUZZLE_OFFSET,
-                    '-');
-            mvaddch((LINE_LEN * 1) + (3 * 1) + PUZZLE_OFFSET, i + PUZZLE_OFFSET,
-                    '-');
-        }
         // Draw number indicators on the side
+        wattron(layer, COLOR_PAIR(3));
         int local_off = 0;
         for (int i = 0; i < LINE_LEN; i++) {
             if (i % 3 == 0)
                 local_off++;
-            mvprintw(i * 4 + PUZZLE_OFFSET + 2, 0, "%d", i + 1);
-            mvprintw(0, i * 4 + PUZZLE_OFFSET + 2, "%d", i + 1);
+            mvwprintw(layer, i * 4 + PUZZLE_OFFSET + 2, 0, "%d", i + 1);
+            mvwprintw(layer, 0, i * 4 + PUZZLE_OFFSET + 2, "%d", i + 1);
         }
     } else {
         // Draw borders for small mode
         for (int x = 0; x < 4; x++) {
             for (int i = 0; i < LINE_LEN + 4; i++)
-                mvaddch(i + PUZZLE_OFFSET, x * 4 + PUZZLE_OFFSET, '|');
+                mvwaddch(layer, i + PUZZLE_OFFSET, x * 4 + PUZZLE_OFFSET, '|');
         }
         for (int y = 0; y < 4; y++) {
             for (int i = 0; i < LINE_LEN + 4; i++)
-                mvaddch(y * 4 + PUZZLE_OFFSET, i + PUZZLE_OFFSET, '-');
+                mvwaddch(layer, y * 4 + PUZZLE_OFFSET, i + PUZZLE_OFFSET, '-');
         }
         // Draw number indicators on the side
         int local_off = 0;
-        attron(COLOR_PAIR(3));
+        wattron(layer, COLOR_PAIR(3));
         for (int i = 0; i < LINE_LEN; i++) {
             if (i % 3 == 0)
                 local_off++;
-            mvprintw(i + PUZZLE_OFFSET + local_off, 0, "%d", i + 1);
-            mvprintw(0, i + PUZZLE_OFFSET + local_off, "%d", i + 1);
+            mvwprintw(layer, i + PUZZLE_OFFSET + local_off, 0, "%d", i + 1);
+            mvwprintw(layer, 0, i + PUZZLE_OFFSET + local_off, "%d", i + 1);
         }
     }
 }
@@ -202,7 +246,11 @@ void read_sudoku(const struct TSStruct *spec, const char *sudoku, int color_mode
                 char current_digit = sudoku[y * LINE_LEN + x];
                 // Draw everything except zeros
                 if (current_digit != '0') {
-                    if (current_digit == spec->highlight) {
+                    if (spec->check.impossible[y * LINE_LEN + x]) {
+                        attron(COLOR_PAIR(6));
+                        addch(current_digit);
+                        attron(COLOR_PAIR(color_mode));
+                    } else if (current_digit == spec->highlight) {
                         attron(COLOR_PAIR(color_mode_highlight));
                         addch(current_digit);
                         attron(COLOR_PAIR(color_mode));
@@ -233,7 +281,11 @@ void read_sudoku(const struct TSStruct *spec, const char *sudoku, int color_mode
                 char current_digit = sudoku[y * LINE_LEN + x];
                 // Draw everything except zeros
                 if (current_digit != '0') {
-                    if (current_digit == spec->highlight) {
+                    if (spec->check.impossible[y * LINE_LEN + x]) {
+                        attron(COLOR_PAIR(6));
+                        addch(current_digit);
+                        attron(COLOR_PAIR(color_mode));
+                    } else if (current_digit == spec->highlight) {
                         attron(COLOR_PAIR(color_mode_highlight));
                         addch(current_digit);
                         attron(COLOR_PAIR(color_mode));
@@ -252,7 +304,7 @@ void read_notes(const struct SudokuSpec *spec)
     attron(COLOR_PAIR(3));
     for (int i = 0; i < SUDOKU_LEN; i++) {
         for (int j = 0; j < LINE_LEN; j++) {
-            if (spec->notes[i * LINE_LEN + j])
+            if (spec->notes[i] & BOARD_NOTE(j + 1))
                 // Move into position for the note
                 mvaddch(((i / LINE_LEN) * 4) + 1 + PUZZLE_OFFSET +
                             (j / (LINE_LEN / 3)),
@@ -263,38 +315,75 @@ void read_notes(const struct SudokuSpec *spec)
     }
 }
 
-// Move cursor but don't get into the seperators
-void move_cursor_to(struct Cursor *curs, bool small_mode, int x, int y)
+// Move cursor but don't get into the seperators. The move is sent at once
+// like that of the ANSI backend, replayed keys ('-k') never call getch().
+static void ncurses_move_cursor(const struct Cursor *curs, bool small_mode)
 {
-    curs->x = x;
-    curs->y = y;
-    if (small_mode) {
-        move(curs->y + (curs->y / 3) + 1 + PUZZLE_OFFSET,
-             curs->x + (curs->x / 3) + 1 + PUZZLE_OFFSET);
-    } else {
-        move((curs->y * 4) + 2 + PUZZLE_OFFSET,
-             (curs->x * 4) + 2 + PUZZLE_OFFSET);
-    }
+    move(CELL_ROW(curs->y, small_mode), CELL_COL(curs->x, small_mode));
+    wnoutrefresh(stdscr);
+    doupdate();
 }
 
-// Move cursor but don't get into the seperators
-void move_cursor(struct Cursor *curs, bool small_mode)
+static void ncurses_show_cursor(bool visible)
 {
-    if (small_mode) {
-        move(curs->y + (curs->y / 3) + 1 + PUZZLE_OFFSET,
-             curs->x + (curs->x / 3) + 1 + PUZZLE_OFFSET);
-    } else {
-        move((curs->y * 4) + 2 + PUZZLE_OFFSET,
-             (curs->x * 4) + 2 + PUZZLE_OFFSET);
+    curs_set(visible);
+}
+
+// Translate curses keys into the keys of render.h
+static int ncurses_translate_key(int key)
+{
+    switch (key) {
+    case ERR:
+        return TS_KEY_NONE;
+    case KEY_DOWN:
+        return TS_KEY_DOWN;
+    case KEY_UP:
+        return TS_KEY_UP;
+    case KEY_LEFT:
+        return TS_KEY_LEFT;
+    case KEY_RIGHT:
+        return TS_KEY_RIGHT;
+    default:
+        return key;
     }
 }
 
+static int ncurses_get_key(void)
+{
+    return ncurses_translate_key(getch());
+}
+
+static int ncurses_poll_key(void)
+{
+    nodelay(stdscr, true);
+    int key = getch();
+    nodelay(stdscr, false);
+
+    return ncurses_translate_key(key);
+}
+
 // Draw user numbers and the given sudoku in different colors
 // Draw the user numbers under the given sudoku so the latter can't be
 // overwritten
 void draw_sudokus(const struct TSStruct *spec)
 {
-    draw_border(spec->opts->small_mode);
-    read_sudoku(spec, spec->sudoku->user, 2, 5);
-    read_sudoku(spec, spec->sudoku->sudoku, 1, 4);
+    char sudoku[SUDOKU_LEN];
+
+    board_numbers_text(spec->sudoku, sudoku);
+    read_sudoku(spec, sudoku, 2, 5);
+    board_clues_text(spec->sudoku, sudoku);
+    read_sudoku(spec, sudoku, 1, 4);
 }
+
+const struct Renderer ncurses_renderer = {
+    .name = "ncurses",
+    .init = ncurses_init,
+    .finish = ncurses_finish,
+    .draw = ncurses_draw,
+    .draw_fileview = ncurses_draw_fileview,
+    .draw_visual = ncurses_draw_visual,
+    .move_cursor = ncurses_move_cursor,
+    .show_cursor = ncurses_show_cursor,
+    .get_key = ncurses_get_key,
+    .poll_key = ncurses_poll_key,
+};
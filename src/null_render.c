@@ -0,0 +1,99 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Renderer that draws nothing, for headless runs. Keys are read as plain bytes
+// from stdin and the game exits once stdin is exhausted.
+
+#include "render.h"
+
+#include "main.h"
+#include "util.h"
+
+#include <poll.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+static void null_init(void)
+{
+}
+
+static void null_finish(void)
+{
+}
+
+static void null_draw(const struct TSStruct *spec)
+{
+    (void)spec;
+}
+
+static void null_draw_fileview(const char *controls, const char *dir, char **items, int count, int position)
+{
+    (void)controls;
+    (void)dir;
+    (void)items;
+    (void)count;
+    (void)position;
+}
+
+static void null_draw_visual(const struct TSStruct *spec, const char *sudoku_to_display)
+{
+    (void)spec;
+    (void)sudoku_to_display;
+}
+
+static void null_move_cursor(const struct Cursor *curs, bool small_mode)
+{
+    (void)curs;
+    (void)small_mode;
+}
+
+static void null_show_cursor(bool visible)
+{
+    (void)visible;
+}
+
+static int null_get_key(void)
+{
+    unsigned char c;
+    if (read(STDIN_FILENO, &c, 1) != 1)
+        finish(0);
+
+    return c;
+}
+
+static int null_poll_key(void)
+{
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    if (poll(&pfd, 1, 0) <= 0)
+        return TS_KEY_NONE;
+
+    return null_get_key();
+}
+
+const struct Renderer null_renderer = {
+    .name = "null",
+    .init = null_init,
+    .finish = null_finish,
+    .draw = null_draw,
+    .draw_fileview = null_draw_fileview,
+    .draw_visual = null_draw_visual,
+    .move_cursor = null_move_cursor,
+    .show_cursor = null_show_cursor,
+    .get_key = null_get_key,
+    .poll_key = null_poll_key,
+};
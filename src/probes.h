@@ -0,0 +1,38 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Static probe points (USDT) for tracing with perf, bpftrace or SystemTap,
+// see "Tracing" in README.md for the list of probes and their arguments.
+// With sys/sdt.h a probe is a single nop until a tracer attaches, without it
+// (or with SUDOKU_PROBES turned off) the probes and their arguments vanish.
+
+#pragma once
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE0(provider, name) DTRACE_PROBE(provider, name)
+#define PROBE1(provider, name, a) DTRACE_PROBE1(provider, name, a)
+#define PROBE2(provider, name, a, b) DTRACE_PROBE2(provider, name, a, b)
+#define PROBE3(provider, name, a, b, c) DTRACE_PROBE3(provider, name, a, b, c)
+#else
+#define PROBE0(provider, name) do {} while (0)
+#define PROBE1(provider, name, a) do {} while (0)
+#define PROBE2(provider, name, a, b) do {} while (0)
+#define PROBE3(provider, name, a, b, c) do {} while (0)
+#endif
@@ -0,0 +1,309 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "render.h"
+
+#include "keytrace.h"
+#include "main.h"
+#include "probes.h"
+#include "util.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const struct Renderer *renderer = &null_renderer;
+static bool renderer_active = false;
+
+static struct TSStruct *vis_gen_spec;
+
+// A single change to the grid during generation, recorded for replay
+struct VisualStep {
+    unsigned char cell;
+    char value;
+};
+
+// State of the visual generator: the last snapshot drawn and the recorded
+// trace of every change the generator made
+static struct {
+    long long frame_interval;
+    long long last_frame;
+    char last[SUDOKU_LEN];
+    struct VisualStep *trace;
+    size_t trace_len;
+    size_t trace_cap;
+} vis;
+
+void record_visual_steps(const char *sudoku_to_display);
+void replay_visual_trace(int speed);
+bool region_edge(enum SudokuVariant variant, int line, int across, bool vertical);
+
+// Translate the argument of '-b' into a backend
+bool parse_backend(const char *name, enum RenderBackend *backend)
+{
+    if (strcmp(name, "ncurses") == 0)
+        *backend = RENDER_NCURSES;
+    else if (strcmp(name, "ansi") == 0)
+        *backend = RENDER_ANSI;
+    else if (strcmp(name, "null") == 0)
+        *backend = RENDER_NULL;
+    else
+        return false;
+
+    return true;
+}
+
+// Whether the piece of line 'line' (0-LINE_LEN, the outer lines included)
+// crossing row or column 'across' separates two regions. Horizontal lines
+// are between rows, vertical ones between columns.
+bool region_edge(enum SudokuVariant variant, int line, int across, bool vertical)
+{
+    if (across < 0 || across >= LINE_LEN)
+        return false;
+    if (line == 0 || line == LINE_LEN)
+        return true;
+
+    int before = vertical ? across * LINE_LEN + line - 1 : (line - 1) * LINE_LEN + across;
+    int after = vertical ? before + 1 : before + LINE_LEN;
+    return sudoku_variant_region(variant, before) != sudoku_variant_region(variant, after);
+}
+
+// The character of the border of normal mode at 'y', 'x' (0 to BORDER_LEN - 1
+// from its top left corner) and its color pair, 0 inside the cells. Lines
+// between regions are yellow, where lines cross the horizontal one wins if it
+// is yellow.
+char border_char(enum SudokuVariant variant, int y, int x, int *color)
+{
+    if (y % 4 == 0 && x % 4 == 0) {
+        if (region_edge(variant, y / 4, x / 4 - 1, false) || region_edge(variant, y / 4, x / 4, false)) {
+            *color = 3;
+            return '-';
+        }
+        *color = region_edge(variant, x / 4, y / 4 - 1, true) || region_edge(variant, x / 4, y / 4, true) ? 3 : 1;
+        return '|';
+    }
+    if (y % 4 == 0) {
+        *color = region_edge(variant, y / 4, x / 4, false) ? 3 : 1;
+        return '-';
+    }
+    if (x % 4 == 0) {
+        *color = region_edge(variant, x / 4, y / 4, true) ? 3 : 1;
+        return '|';
+    }
+
+    return 0;
+}
+
+// What the border shows in 'cell' while it is empty: '.' on the extra units of
+// a variant (like the diagonals), in small mode also the letter of the jigsaw
+// region since its borders are not drawn. 0 for nothing.
+char cell_marker(enum SudokuVariant variant, int cell, bool small_mode)
+{
+    if (sudoku_variant_marked(variant, cell))
+        return '.';
+    if (small_mode && variant == SUDOKU_VARIANT_JIGSAW)
+        return 'a' + sudoku_variant_region(variant, cell);
+
+    return 0;
+}
+
+void init_renderer(enum RenderBackend backend)
+{
+    switch (backend) {
+    case RENDER_NCURSES:
+        renderer = &ncurses_renderer;
+        break;
+    case RENDER_ANSI:
+        renderer = &ansi_renderer;
+        break;
+    case RENDER_NULL:
+        renderer = &null_renderer;
+        break;
+    }
+
+    renderer->init();
+    renderer_active = true;
+}
+
+// Give the terminal back; safe to call more than once and before
+// init_renderer()
+void finish_renderer(void)
+{
+    if (!renderer_active)
+        return;
+
+    renderer_active = false;
+    renderer->finish();
+}
+
+// Draws everything
+void draw(const struct TSStruct *spec)
+{
+    PROBE0(term_sudoku, draw__start);
+    keytrace_draw_begin();
+    renderer->draw(spec);
+    keytrace_draw_end();
+    PROBE0(term_sudoku, draw__end);
+}
+
+// Draws the list of save files of '-f'
+void draw_fileview(const char *controls, const char *dir, char **items, int count, int position)
+{
+    PROBE0(term_sudoku, draw__start);
+    keytrace_draw_begin();
+    renderer->draw_fileview(controls, dir, items, count, position);
+    keytrace_draw_end();
+    PROBE0(term_sudoku, draw__end);
+}
+
+// Move cursor but don't get into the seperators
+void move_cursor_to(struct Cursor *curs, bool small_mode, int x, int y)
+{
+    curs->x = x;
+    curs->y = y;
+    renderer->move_cursor(curs, small_mode);
+}
+
+// Move cursor but don't get into the seperators
+void move_cursor(struct Cursor *curs, bool small_mode)
+{
+    renderer->move_cursor(curs, small_mode);
+}
+
+void show_cursor(bool visible)
+{
+    renderer->show_cursor(visible);
+}
+
+// Keys come from the backend, or from the trace given with '-k'
+int get_key(void)
+{
+    if (keytrace_replaying())
+        return keytrace_next_key();
+
+    int key = renderer->get_key();
+    keytrace_record(key);
+
+    return key;
+}
+
+int poll_key(void)
+{
+    // A replayed trace is fed one key at a time
+    if (keytrace_replaying())
+        return TS_KEY_NONE;
+
+    int key = renderer->poll_key();
+    if (key != TS_KEY_NONE)
+        keytrace_record(key);
+
+    return key;
+}
+
+void init_visual_generator(struct TSStruct *spec)
+{
+    vis_gen_spec = spec;
+
+    vis.frame_interval = 1000000000LL / spec->opts->gen_fps;
+    vis.last_frame = 0;
+    memset(vis.last, '0', sizeof(vis.last));
+    vis.trace_len = 0;
+}
+
+// For -v flag: show the generating process
+// The generator calls this on every step and runs at full speed, frames are
+// only drawn once the frame interval ('-F') has passed
+void generate_visually(const char *sudoku_to_display)
+{
+    assert(vis_gen_spec != NULL);
+
+    if (vis_gen_spec->opts->replay_speed > 0)
+        record_visual_steps(sudoku_to_display);
+
+    long long now = monotonic_ns();
+    if (now - vis.last_frame < vis.frame_interval)
+        return;
+
+    vis.last_frame = now;
+    renderer->draw_visual(vis_gen_spec, sudoku_to_display);
+}
+
+// Called once generation is done: show the final grid and replay the recorded
+// trace if that was requested with '-r'
+void end_visual_generation(const char *sudoku_to_display)
+{
+    assert(vis_gen_spec != NULL);
+
+    if (vis_gen_spec->opts->replay_speed > 0) {
+        record_visual_steps(sudoku_to_display);
+        replay_visual_trace(vis_gen_spec->opts->replay_speed);
+    }
+
+    renderer->draw_visual(vis_gen_spec, sudoku_to_display);
+
+    free(vis.trace);
+    vis.trace = NULL;
+    vis.trace_len = vis.trace_cap = 0;
+}
+
+// Append every cell that changed since the last call to the trace
+void record_visual_steps(const char *sudoku_to_display)
+{
+    for (int i = 0; i < SUDOKU_LEN; i++) {
+        if (sudoku_to_display[i] == vis.last[i])
+            continue;
+
+        if (vis.trace_len == vis.trace_cap) {
+            vis.trace_cap = vis.trace_cap ? vis.trace_cap * 2 : 1024;
+            vis.trace = realloc(vis.trace, vis.trace_cap * sizeof(*vis.trace));
+            if (vis.trace == NULL)
+                finish_with_errno("Recording generation trace");
+        }
+
+        vis.trace[vis.trace_len++] = (struct VisualStep){ i, sudoku_to_display[i] };
+        vis.last[i] = sudoku_to_display[i];
+    }
+}
+
+// Play back the recorded trace at 'speed' steps per second, one frame per
+// frame interval; any key skips to the end
+void replay_visual_trace(int speed)
+{
+    char replay[SUDOKU_LEN];
+    memset(replay, '0', sizeof(replay));
+
+    size_t step = 0;
+    long long start = monotonic_ns();
+
+    while (step < vis.trace_len && poll_key() == TS_KEY_NONE) {
+        long long elapsed = monotonic_ns() - start;
+        size_t target = (size_t)(elapsed / 1000000LL * speed / 1000);
+
+        for (; step < target && step < vis.trace_len; step++)
+            replay[vis.trace[step].cell] = vis.trace[step].value;
+
+        renderer->draw_visual(vis_gen_spec, replay);
+
+        struct timespec frame = {
+            vis.frame_interval / 1000000000LL,
+            vis.frame_interval % 1000000000LL,
+        };
+        nanosleep(&frame, NULL);
+    }
+}
@@ -0,0 +1,80 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "main.h"
+
+#include <stdbool.h>
+
+// Keys that are not plain characters, translated by each backend
+#define TS_KEY_NONE (-1)
+#define TS_KEY_DOWN 0x102
+#define TS_KEY_UP 0x103
+#define TS_KEY_LEFT 0x104
+#define TS_KEY_RIGHT 0x105
+
+struct Cursor {
+    int y;
+    int x;
+};
+
+// Operations every backend has to provide
+struct Renderer {
+    const char *name;
+    void (*init)(void);
+    void (*finish)(void);
+    void (*draw)(const struct TSStruct *spec);
+    void (*draw_fileview)(const char *controls, const char *dir, char **items, int count, int position);
+    void (*draw_visual)(const struct TSStruct *spec, const char *sudoku_to_display);
+    void (*move_cursor)(const struct Cursor *curs, bool small_mode);
+    void (*show_cursor)(bool visible);
+    // Blocks until a key is available
+    int (*get_key)(void);
+    // Returns TS_KEY_NONE if no key is pending
+    int (*poll_key)(void);
+};
+
+extern const struct Renderer ncurses_renderer;
+extern const struct Renderer ansi_renderer;
+extern const struct Renderer null_renderer;
+
+// Screen position of the digit of a cell (also where the cursor is placed)
+#define CELL_ROW(y, small_mode) ((small_mode) ? (y) + ((y) / 3) + 1 + PUZZLE_OFFSET \
+                                              : ((y) * 4) + 2 + PUZZLE_OFFSET)
+#define CELL_COL(x, small_mode) ((small_mode) ? (x) + ((x) / 3) + 1 + PUZZLE_OFFSET \
+                                              : ((x) * 4) + 2 + PUZZLE_OFFSET)
+
+// Size of the border of normal mode, without the numbers on the sides
+#define BORDER_LEN ((LINE_LEN * 4) + 1)
+
+bool parse_backend(const char *name, enum RenderBackend *backend);
+char border_char(enum SudokuVariant variant, int y, int x, int *color);
+char cell_marker(enum SudokuVariant variant, int cell, bool small_mode);
+void init_renderer(enum RenderBackend backend);
+void finish_renderer(void);
+void draw(const struct TSStruct *spec);
+void draw_fileview(const char *controls, const char *dir, char **items, int count, int position);
+void move_cursor_to(struct Cursor *curs, bool small_mode, int x, int y);
+void move_cursor(struct Cursor *curs, bool small_mode);
+void show_cursor(bool visible);
+int get_key(void);
+int poll_key(void);
+void init_visual_generator(struct TSStruct *spec);
+void generate_visually(const char *sudoku_to_display);
+void end_visual_generation(const char *sudoku_to_display);
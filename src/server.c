@@ -0,0 +1,666 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Puzzle service for '--serve': answers requests over a UNIX domain socket.
+//
+// The protocol is line based, one request per line, one response per line:
+//
+//   GEN [ATTEMPTS]    -> OK <puzzle>
+//   SOLVE <puzzle>    -> OK <solution>     | ERR no solution
+//   COUNT <puzzle>    -> OK <0, 1 or 2>    (2 meaning more than one)
+//   VALIDATE <grid>   -> OK valid | OK solved | OK conflicts <cells>
+//
+// Games are played in sessions (see session.c), named by the id NEW answers
+// with. Cells are numbered 0-80 row by row, digit 0 clears a cell:
+//
+//   NEW [ATTEMPTS]            -> OK <id> <puzzle>
+//   SHOW <id>                 -> OK <clues> <numbers> <cursor> <mode>
+//   NOTES <id> <cell>         -> OK <digits noted, 0 for none>
+//   MOVE <id> <cell>          -> OK
+//   MODE <id> <0 or 1>        -> OK    (1 while entering notes)
+//   PUT <id> <cell> <digit>   -> OK | OK unchanged
+//   NOTE <id> <cell> <digit>  -> OK | OK unchanged
+//   UNDO <id> | REDO <id>     -> OK <cell> | OK unchanged
+//   CHECK <id>                -> OK valid | OK invalid
+//   FILL <id>                 -> OK <grid> | ERR no solution | ERR changed while solving
+//   END <id>                  -> OK
+//
+// Puzzles are written as 81 characters in the format of sudoku_parse().
+// Errors are answered with "ERR <message>".
+//
+// The main thread reads the requests of all connections and puts them into a
+// bounded queue; requests that do not fit are answered with "ERR busy". A pool
+// of workers, each of which owns its own solver context, answers them. Every
+// connection has at most one request in the queue, so responses arrive in
+// order. A filler thread keeps a cache of pre-generated puzzles so that GEN
+// usually does not have to generate. The sessions are shared by the workers
+// under a lock, which CHECK and FILL do not hold while the solver runs; the
+// main thread writes idle sessions to disk.
+
+#include "server.h"
+
+#include "game.h"
+#include "main.h"
+#include "session.h"
+#include "sudoku.h"
+#include "util.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+struct Request {
+    int conn;
+    char line[SERVER_LINE_LEN];
+};
+
+struct RequestQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    struct Request requests[SERVER_QUEUE_LEN];
+    int head;
+    int len;
+};
+
+struct Connection {
+    int fd;
+    // A request of this connection is being answered
+    bool busy;
+    // The peer is gone, close once the request in flight is answered
+    bool closing;
+    char buf[SERVER_LINE_LEN];
+    size_t len;
+};
+
+struct PuzzleCache {
+    pthread_mutex_t lock;
+    pthread_cond_t not_full;
+    char puzzles[SERVER_CACHE_LEN][SUDOKU_LEN];
+    int head;
+    int len;
+};
+
+struct Worker {
+    pthread_t thread;
+    struct SudokuCtx *ctx;
+};
+
+static struct {
+    const char *socket_path;
+    int attempts;
+    enum SudokuVariant variant;
+    struct RequestQueue queue;
+    struct PuzzleCache cache;
+    struct Connection conns[SERVER_MAX_CONNS];
+    // Workers write the index of a connection here once they answered it
+    int done_pipe[2];
+    pthread_mutex_t sessions_lock;
+    struct SessionStore *sessions;
+} server = {
+    .queue = { .lock = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER },
+    .cache = { .lock = PTHREAD_MUTEX_INITIALIZER, .not_full = PTHREAD_COND_INITIALIZER },
+    .sessions_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Set by SIGINT and SIGTERM, the main thread then writes the sessions to disk
+static volatile sig_atomic_t stopping;
+
+// Put a request into the queue, false if the queue is full
+static bool queue_push(int conn, const char *line)
+{
+    pthread_mutex_lock(&server.queue.lock);
+    bool pushed = server.queue.len < SERVER_QUEUE_LEN;
+    if (pushed) {
+        struct Request *request =
+            &server.queue.requests[(server.queue.head + server.queue.len) % SERVER_QUEUE_LEN];
+        request->conn = conn;
+        // The line comes from a connection buffer of the same size
+        memcpy(request->line, line, strlen(line) + 1);
+        server.queue.len++;
+        pthread_cond_signal(&server.queue.not_empty);
+    }
+    pthread_mutex_unlock(&server.queue.lock);
+
+    return pushed;
+}
+
+static void queue_pop(struct Request *request)
+{
+    pthread_mutex_lock(&server.queue.lock);
+    while (server.queue.len == 0)
+        pthread_cond_wait(&server.queue.not_empty, &server.queue.lock);
+
+    *request = server.queue.requests[server.queue.head];
+    server.queue.head = (server.queue.head + 1) % SERVER_QUEUE_LEN;
+    server.queue.len--;
+    pthread_mutex_unlock(&server.queue.lock);
+}
+
+// Take a pre-generated puzzle, false if the cache is empty
+static bool cache_take(char *puzzle)
+{
+    pthread_mutex_lock(&server.cache.lock);
+    bool taken = server.cache.len > 0;
+    if (taken) {
+        memcpy(puzzle, server.cache.puzzles[server.cache.head], SUDOKU_LEN);
+        server.cache.head = (server.cache.head + 1) % SERVER_CACHE_LEN;
+        server.cache.len--;
+        pthread_cond_signal(&server.cache.not_full);
+    }
+    pthread_mutex_unlock(&server.cache.lock);
+
+    return taken;
+}
+
+// Keep the cache of puzzles filled
+static void *cache_filler(void *arg)
+{
+    struct SudokuCtx *ctx = arg;
+    char puzzle[SUDOKU_LEN];
+
+    for (;;) {
+        pthread_mutex_lock(&server.cache.lock);
+        while (server.cache.len == SERVER_CACHE_LEN)
+            pthread_cond_wait(&server.cache.not_full, &server.cache.lock);
+        pthread_mutex_unlock(&server.cache.lock);
+
+        sudoku_generate(ctx, puzzle);
+
+        pthread_mutex_lock(&server.cache.lock);
+        memcpy(server.cache.puzzles[(server.cache.head + server.cache.len) % SERVER_CACHE_LEN],
+               puzzle, SUDOKU_LEN);
+        server.cache.len++;
+        pthread_mutex_unlock(&server.cache.lock);
+    }
+
+    return NULL;
+}
+
+// Read the puzzle argument of a request, false if it is not one
+static bool read_puzzle_arg(const char *arg, char *puzzle)
+{
+    if (arg == NULL)
+        return false;
+
+    return sudoku_parse(arg, strlen(arg), puzzle) == SUDOKU_LEN;
+}
+
+// A new puzzle for GEN and NEW, from the cache unless 'arg' asks for another
+// number of attempts
+static void next_puzzle(struct SudokuCtx *ctx, const char *arg, char *puzzle)
+{
+    int attempts = arg != NULL ? strtol(arg, NULL, 10) : server.attempts;
+    if (attempts == server.attempts && cache_take(puzzle))
+        return;
+
+    // Only for this puzzle, the worker goes on with the attempts of '-n'
+    sudoku_ctx_set_attempts(ctx, attempts);
+    sudoku_generate(ctx, puzzle);
+    sudoku_ctx_set_attempts(ctx, server.attempts);
+}
+
+// Answer a request on a session: 'arg' is the id followed by the arguments
+// of the command
+static void handle_session_request(struct SudokuCtx *ctx, const char *command, const char *arg,
+                                   char *response, size_t sz)
+{
+    uint64_t id;
+    int cell = 0, digit = 0, end = 0;
+    int args = arg != NULL ? sscanf(arg, "%" SCNx64 " %d %d %n", &id, &cell, &digit, &end) : 0;
+    if (args < 1) {
+        snprintf(response, sz, "ERR no session id");
+        return;
+    }
+
+    // Moves on a cell take a cell, PUT and NOTE a digit as well. MODE takes
+    // its mode in place of the cell.
+    bool takes_digit = strcmp(command, "PUT") == 0 || strcmp(command, "NOTE") == 0;
+    bool takes_cell = strcmp(command, "NOTES") == 0 || strcmp(command, "MOVE") == 0 ||
+                      strcmp(command, "MODE") == 0;
+    if ((takes_digit && args < 3) || (takes_cell && args < 2)) {
+        snprintf(response, sz, "ERR missing cell or digit");
+        return;
+    }
+    if ((takes_digit && digit < 0) || (strcmp(command, "MODE") == 0 && cell != 0 && cell != 1)) {
+        snprintf(response, sz, "ERR %s", session_result_text(SESSION_INVALID));
+        return;
+    }
+
+    struct SudokuSpec board;
+    struct SessionView view;
+    enum SessionResult result = SESSION_INVALID;
+    bool valid = false;
+    char grid[SUDOKU_LEN];
+    char numbers[SUDOKU_LEN];
+
+    pthread_mutex_lock(&server.sessions_lock);
+    if (strcmp(command, "SHOW") == 0 || strcmp(command, "NOTES") == 0)
+        result = session_get(server.sessions, id, &board, &view);
+    else if (strcmp(command, "PUT") == 0)
+        result = digit == 0 ? session_erase(server.sessions, id, cell)
+                            : session_insert(server.sessions, id, cell, digit);
+    else if (strcmp(command, "NOTE") == 0)
+        result = session_toggle_note(server.sessions, id, cell, digit);
+    else if (strcmp(command, "MOVE") == 0)
+        result = session_move(server.sessions, id, cell);
+    else if (strcmp(command, "MODE") == 0)
+        result = session_set_note_mode(server.sessions, id, cell == 1);
+    else if (strcmp(command, "UNDO") == 0)
+        result = session_undo(server.sessions, id, &cell);
+    else if (strcmp(command, "REDO") == 0)
+        result = session_redo(server.sessions, id, &cell);
+    else if (strcmp(command, "CHECK") == 0 || strcmp(command, "FILL") == 0)
+        result = session_get(server.sessions, id, &board, NULL);
+    else if (strcmp(command, "END") == 0)
+        result = session_end(server.sessions, id);
+    pthread_mutex_unlock(&server.sessions_lock);
+
+    // The solver runs on a copy of the board, so that the other sessions do
+    // not wait for it. A session kept from a run with another '--variant'
+    // has rules of its own, the worker goes back to those of the server.
+    if (result == SESSION_OK && strcmp(command, "CHECK") == 0) {
+        sudoku_ctx_set_variant(ctx, board.variant);
+        valid = game_check(ctx, &board);
+        sudoku_ctx_set_variant(ctx, server.variant);
+    } else if (result == SESSION_OK && strcmp(command, "FILL") == 0) {
+        board_grid_text(&board, grid);
+        sudoku_ctx_set_variant(ctx, board.variant);
+        bool solved = sudoku_solve(ctx, grid);
+        sudoku_ctx_set_variant(ctx, server.variant);
+        if (solved) {
+            pthread_mutex_lock(&server.sessions_lock);
+            result = session_fill(server.sessions, id, &board, grid);
+            pthread_mutex_unlock(&server.sessions_lock);
+        } else {
+            result = SESSION_NO_SOLUTION;
+        }
+    }
+
+    if (result == SESSION_UNCHANGED) {
+        snprintf(response, sz, "OK unchanged");
+    } else if (result != SESSION_OK) {
+        snprintf(response, sz, "ERR %s", session_result_text(result));
+    } else if (strcmp(command, "SHOW") == 0) {
+        board_clues_text(&board, grid);
+        board_numbers_text(&board, numbers);
+        snprintf(response, sz, "OK %.*s %.*s %d %d", SUDOKU_LEN, grid, SUDOKU_LEN, numbers, view.cursor,
+                 view.editing_notes);
+    } else if (strcmp(command, "NOTES") == 0) {
+        if (cell < 0 || cell >= SUDOKU_LEN) {
+            snprintf(response, sz, "ERR %s", session_result_text(SESSION_INVALID));
+            return;
+        }
+        int len = snprintf(response, sz, "OK ");
+        for (int d = 1; d <= LINE_LEN; d++) {
+            if (board.notes[cell] & BOARD_NOTE(d))
+                len += snprintf(response + len, sz - len, "%d", d);
+        }
+        if (board.notes[cell] == 0)
+            snprintf(response + len, sz - len, "0");
+    } else if (strcmp(command, "UNDO") == 0 || strcmp(command, "REDO") == 0) {
+        snprintf(response, sz, "OK %d", cell);
+    } else if (strcmp(command, "CHECK") == 0) {
+        snprintf(response, sz, "OK %s", valid ? "valid" : "invalid");
+    } else if (strcmp(command, "FILL") == 0) {
+        snprintf(response, sz, "OK %.*s", SUDOKU_LEN, grid);
+    } else {
+        snprintf(response, sz, "OK");
+    }
+}
+
+// Whether 'command' is one of the requests on a session
+static bool is_session_command(const char *command)
+{
+    static const char *const commands[] = {
+        "SHOW", "NOTES", "MOVE", "MODE", "PUT", "NOTE", "UNDO", "REDO", "CHECK", "FILL", "END",
+    };
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(command, commands[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Answer a single request line into 'response'
+static void handle_request(struct SudokuCtx *ctx, char *line, char *response, size_t sz)
+{
+    char puzzle[SUDOKU_LEN];
+
+    char *saveptr;
+    char *command = strtok_r(line, " \t\r\n", &saveptr);
+    char *arg = command != NULL ? strtok_r(NULL, "\r\n", &saveptr) : NULL;
+
+    if (command == NULL) {
+        snprintf(response, sz, "ERR empty request");
+    } else if (strcmp(command, "GEN") == 0) {
+        next_puzzle(ctx, arg, puzzle);
+        snprintf(response, sz, "OK %.*s", SUDOKU_LEN, puzzle);
+    } else if (strcmp(command, "NEW") == 0) {
+        next_puzzle(ctx, arg, puzzle);
+
+        struct SudokuSpec board;
+        board_clear(&board);
+        board_set_clues(&board, puzzle);
+        board.variant = server.variant;
+
+        uint64_t id;
+        pthread_mutex_lock(&server.sessions_lock);
+        bool created = session_create(server.sessions, &board, &id);
+        pthread_mutex_unlock(&server.sessions_lock);
+
+        if (created)
+            snprintf(response, sz, "OK %016" PRIx64 " %.*s", id, SUDOKU_LEN, puzzle);
+        else
+            snprintf(response, sz, "ERR %s", session_result_text(SESSION_FAILED));
+    } else if (is_session_command(command)) {
+        handle_session_request(ctx, command, arg, response, sz);
+    } else if (strcmp(command, "SOLVE") == 0) {
+        if (!read_puzzle_arg(arg, puzzle))
+            snprintf(response, sz, "ERR not a puzzle");
+        else if (sudoku_find_conflicts(ctx, puzzle, NULL) > 0 || !sudoku_solve(ctx, puzzle))
+            snprintf(response, sz, "ERR no solution");
+        else
+            snprintf(response, sz, "OK %.*s", SUDOKU_LEN, puzzle);
+    } else if (strcmp(command, "COUNT") == 0) {
+        if (!read_puzzle_arg(arg, puzzle))
+            snprintf(response, sz, "ERR not a puzzle");
+        else if (sudoku_find_conflicts(ctx, puzzle, NULL) > 0)
+            snprintf(response, sz, "OK 0");
+        else
+            snprintf(response, sz, "OK %d", sudoku_count_solutions(ctx, puzzle));
+    } else if (strcmp(command, "VALIDATE") == 0) {
+        int count;
+        if (!read_puzzle_arg(arg, puzzle))
+            snprintf(response, sz, "ERR not a puzzle");
+        else if ((count = sudoku_find_conflicts(ctx, puzzle, NULL)) > 0)
+            snprintf(response, sz, "OK conflicts %d", count);
+        else
+            snprintf(response, sz, "OK %s", sudoku_check_validity(ctx, puzzle) ? "solved" : "valid");
+    } else {
+        snprintf(response, sz, "ERR unknown request '%s'", command);
+    }
+}
+
+// Answer the requests of the queue
+static void *worker(void *arg)
+{
+    struct Worker *self = arg;
+    struct Request request;
+    char response[SERVER_LINE_LEN];
+
+    for (;;) {
+        queue_pop(&request);
+
+        handle_request(self->ctx, request.line, response, sizeof(response));
+        dprintf(server.conns[request.conn].fd, "%s\n", response);
+
+        // Hand the connection back to the main thread
+        if (write(server.done_pipe[1], &request.conn, sizeof(request.conn)) != sizeof(request.conn))
+            perror("Signalling finished request");
+    }
+
+    return NULL;
+}
+
+static void close_conn(int conn)
+{
+    close(server.conns[conn].fd);
+    server.conns[conn].fd = -1;
+}
+
+// Queue the next complete line of a connection that has nothing in flight
+static void dispatch_conn(int conn)
+{
+    struct Connection *c = &server.conns[conn];
+
+    if (c->busy || c->fd == -1)
+        return;
+
+    char *newline = memchr(c->buf, '\n', c->len);
+    if (newline == NULL) {
+        if (c->closing) {
+            close_conn(conn);
+        } else if (c->len == sizeof(c->buf)) {
+            dprintf(c->fd, "ERR request too long\n");
+            close_conn(conn);
+        }
+        return;
+    }
+
+    *newline = '\0';
+    if (queue_push(conn, c->buf))
+        c->busy = true;
+    else
+        dprintf(c->fd, "ERR busy\n");
+
+    size_t line_len = newline - c->buf + 1;
+    memmove(c->buf, c->buf + line_len, c->len - line_len);
+    c->len -= line_len;
+
+    // A request that could not be queued does not block the following ones
+    if (!c->busy)
+        dispatch_conn(conn);
+}
+
+static void accept_conn(int listen_fd)
+{
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd == -1)
+        return;
+
+    for (int i = 0; i < SERVER_MAX_CONNS; i++) {
+        if (server.conns[i].fd == -1) {
+            server.conns[i] = (struct Connection){ .fd = fd };
+            return;
+        }
+    }
+
+    dprintf(fd, "ERR too many connections\n");
+    close(fd);
+}
+
+static void read_conn(int conn)
+{
+    struct Connection *c = &server.conns[conn];
+
+    ssize_t got = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+    if (got <= 0)
+        c->closing = true;
+    else
+        c->len += got;
+
+    dispatch_conn(conn);
+}
+
+static struct SudokuCtx *new_server_ctx(const struct TSOpts *opts, unsigned long long seed, int index)
+{
+    struct SudokuCtx *ctx = sudoku_ctx_new();
+    if (ctx == NULL) {
+        perror("Allocating solver");
+        exit(1);
+    }
+    sudoku_ctx_seed(ctx, seed + index * 0x9e3779b97f4a7c15ULL);
+    sudoku_ctx_set_attempts(ctx, opts->attempts);
+    sudoku_ctx_set_time_budget(ctx, opts->time_budget);
+    sudoku_ctx_set_threads(ctx, opts->threads);
+    sudoku_ctx_set_speculation(ctx, opts->speculate);
+    sudoku_ctx_set_difficulty(ctx, opts->difficulty);
+    sudoku_ctx_set_minimal(ctx, opts->minimal);
+    sudoku_ctx_set_variant(ctx, opts->variant);
+
+    return ctx;
+}
+
+static void stop_server(int sig)
+{
+    (void)sig;
+    stopping = 1;
+}
+
+// Keep the sessions for the next run
+static void save_sessions(void)
+{
+    pthread_mutex_lock(&server.sessions_lock);
+    int left = session_store_len(server.sessions) - session_evict_idle(server.sessions, 0);
+    pthread_mutex_unlock(&server.sessions_lock);
+
+    if (left > 0)
+        fprintf(stderr, "Could not save %d sessions\n", left);
+}
+
+// Run the puzzle service on 'socket_path' until interrupted
+int serve(const struct TSOpts *opts, const char *socket_path, unsigned long long seed)
+{
+    server.socket_path = socket_path;
+    server.attempts = opts->attempts;
+    server.variant = opts->variant;
+
+    // Idle sessions go to a directory of their own next to the save files
+    char sessions_dir[PATH_MAX];
+    snprintf(sessions_dir, sizeof(sessions_dir), "%s/sessions", opts->dir);
+    if (mkdir(sessions_dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Creating %s: %s\n", sessions_dir, strerror(errno));
+        return 1;
+    }
+    server.sessions = session_store_new(SERVER_SESSIONS_LEN, sessions_dir, seed);
+    if (server.sessions == NULL) {
+        perror("Allocating sessions");
+        return 1;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd == -1) {
+        perror("socket");
+        return 1;
+    }
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listen_fd, SERVER_QUEUE_LEN) == -1) {
+        fprintf(stderr, "Listening on %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+
+    if (pipe(server.done_pipe) == -1) {
+        perror("pipe");
+        return 1;
+    }
+    for (int i = 0; i < SERVER_MAX_CONNS; i++)
+        server.conns[i].fd = -1;
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int worker_count = cpus > 0 ? cpus : 1;
+
+    // Every thread gets its own solver context, seeded apart from the others
+    struct Worker *workers = calloc(worker_count, sizeof(*workers));
+    if (workers == NULL) {
+        perror("Allocating workers");
+        return 1;
+    }
+    for (int i = 0; i < worker_count; i++) {
+        workers[i].ctx = new_server_ctx(opts, seed, i);
+        int ret = pthread_create(&workers[i].thread, NULL, worker, &workers[i]);
+        if (ret != 0) {
+            fprintf(stderr, "Starting workers: %s\n", strerror(ret));
+            return 1;
+        }
+    }
+
+    pthread_t filler;
+    int ret = pthread_create(&filler, NULL, cache_filler, new_server_ctx(opts, seed, worker_count));
+    if (ret != 0) {
+        fprintf(stderr, "Starting cache filler: %s\n", strerror(ret));
+        return 1;
+    }
+
+    fprintf(stderr, "Serving on %s with %d workers\n", socket_path, worker_count);
+
+    // Slot 0 is the listening socket, slot 1 the pipe of finished requests,
+    // the connections follow
+    static struct pollfd fds[SERVER_MAX_CONNS + 2];
+    static int fd_conns[SERVER_MAX_CONNS + 2];
+
+    long long last_eviction = monotonic_ns();
+    while (!stopping) {
+        int nfds = 0;
+        fds[nfds++] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+        fds[nfds++] = (struct pollfd){ .fd = server.done_pipe[0], .events = POLLIN };
+        for (int i = 0; i < SERVER_MAX_CONNS; i++) {
+            // Connections with a request in flight are not read from, so a
+            // client can not flood the queue
+            if (server.conns[i].fd != -1 && !server.conns[i].busy && !server.conns[i].closing) {
+                fd_conns[nfds] = i;
+                fds[nfds++] = (struct pollfd){ .fd = server.conns[i].fd, .events = POLLIN };
+            }
+        }
+
+        if (poll(fds, nfds, SERVER_POLL_MS) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+
+        if (monotonic_ns() - last_eviction >= SERVER_POLL_MS * 1000000LL) {
+            pthread_mutex_lock(&server.sessions_lock);
+            session_evict_idle(server.sessions, SERVER_SESSION_IDLE_NS);
+            pthread_mutex_unlock(&server.sessions_lock);
+            last_eviction = monotonic_ns();
+        }
+
+        if (fds[1].revents & POLLIN) {
+            int conn;
+            if (read(server.done_pipe[0], &conn, sizeof(conn)) == sizeof(conn)) {
+                server.conns[conn].busy = false;
+                dispatch_conn(conn);
+            }
+        }
+
+        for (int i = 2; i < nfds; i++) {
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+                read_conn(fd_conns[i]);
+        }
+
+        if (fds[0].revents & POLLIN)
+            accept_conn(listen_fd);
+    }
+
+    save_sessions();
+    unlink(socket_path);
+    return stopping ? 0 : 1;
+}
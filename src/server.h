@@ -0,0 +1,36 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "main.h"
+
+// Number of requests that may wait for a worker
+#define SERVER_QUEUE_LEN 64
+#define SERVER_MAX_CONNS 1024
+// Number of pre-generated puzzles kept ready
+#define SERVER_CACHE_LEN 256
+#define SERVER_LINE_LEN 256
+// Sessions kept in memory, and how long one may go unused before it is
+// written to disk
+#define SERVER_SESSIONS_LEN 4096
+#define SERVER_SESSION_IDLE_NS (10 * 60 * 1000000000LL)
+// Longest wait of the main thread, between checks for idle sessions
+#define SERVER_POLL_MS 1000
+
+int serve(const struct TSOpts *opts, const char *socket_path, unsigned long long seed);
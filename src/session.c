@@ -0,0 +1,525 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Many games in one process, for the puzzle service: each is a session with
+// its board, cursor and undo history, found by a 64-bit id. The sessions live
+// in slots, one array per field, so that the scans for eviction only touch
+// the ids and the times of last use. Sessions that were not used for a while
+// are written to a file in the directory of the store and read back once they
+// are asked for again, so the store can hold far more games than slots.
+//
+// The store is not locked, callers from several threads have to take turns.
+
+#include "session.h"
+
+#include "game.h"
+#include "history.h"
+#include "main.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Longest path of a session file: the directory, the id in hex and ".session"
+#define SESSION_PATH_LEN (PATH_MAX + 32)
+// Entry of the index without a session
+#define SESSION_NO_SLOT (-1)
+
+struct SessionStore {
+    // Sessions that fit in memory, and how many are there
+    int cap;
+    int len;
+    // Where idle sessions are written to
+    char dir[PATH_MAX];
+    // Ids are a bijective mix of the seed and a counter, so they never repeat
+    unsigned long long seed;
+    unsigned long long created;
+
+    // Slot i of every array belongs to the same session, 'ids' is 0 for a
+    // free slot. The edits of a history grow with the moves.
+    uint64_t *ids;
+    long long *last_used;
+    struct SudokuSpec *boards;
+    struct History *histories;
+    uint8_t *cursors;
+    bool *editing_notes;
+    // Free slots, taken from the end
+    int *free_slots;
+    int free_len;
+
+    // Slot of every id in memory, by open addressing with linear probing.
+    // 'index_len' is a power of two, at least twice 'cap'.
+    uint64_t *index_ids;
+    int *index_slots;
+    int index_len;
+};
+
+static uint64_t mix_id(unsigned long long x);
+static int index_find(const struct SessionStore *store, uint64_t id);
+static void index_remove(struct SessionStore *store, uint64_t id);
+static void session_path(const struct SessionStore *store, uint64_t id, char *path);
+static int take_slot(struct SessionStore *store);
+static void release_slot(struct SessionStore *store, int slot);
+static bool evict(struct SessionStore *store, int slot);
+static enum SessionResult load(struct SessionStore *store, uint64_t id, int *slot);
+static enum SessionResult lookup(struct SessionStore *store, uint64_t id, int *slot);
+static enum SessionResult check_cell(int cell);
+static enum SessionResult check_digit(int cell, int digit);
+
+// splitmix64: a bijection that spreads consecutive numbers over all bits
+static uint64_t mix_id(unsigned long long x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Position of 'id' in the index, or of the empty entry where it would go
+static int index_find(const struct SessionStore *store, uint64_t id)
+{
+    int mask = store->index_len - 1;
+    int i = id & mask;
+    while (store->index_slots[i] != SESSION_NO_SLOT && store->index_ids[i] != id)
+        i = (i + 1) & mask;
+    return i;
+}
+
+// Take 'id' out of the index, moving the entries after it back to where a
+// search finds them without a gap
+static void index_remove(struct SessionStore *store, uint64_t id)
+{
+    int mask = store->index_len - 1;
+    int hole = index_find(store, id);
+    if (store->index_slots[hole] == SESSION_NO_SLOT)
+        return;
+
+    for (int i = (hole + 1) & mask; store->index_slots[i] != SESSION_NO_SLOT; i = (i + 1) & mask) {
+        int home = store->index_ids[i] & mask;
+        // Entries whose home lies cyclically in (hole, i] stay
+        if (((i - home) & mask) < ((i - hole) & mask))
+            continue;
+        store->index_ids[hole] = store->index_ids[i];
+        store->index_slots[hole] = store->index_slots[i];
+        hole = i;
+    }
+    store->index_slots[hole] = SESSION_NO_SLOT;
+}
+
+static void session_path(const struct SessionStore *store, uint64_t id, char *path)
+{
+    snprintf(path, SESSION_PATH_LEN, "%s/%016llx.session", store->dir, (unsigned long long)id);
+}
+
+// A store for 'cap' sessions in memory that writes idle ones to 'dir', NULL
+// if there is not enough memory
+struct SessionStore *session_store_new(int cap, const char *dir, unsigned long long seed)
+{
+    struct SessionStore *store = calloc(1, sizeof(*store));
+    if (store == NULL)
+        return NULL;
+
+    store->cap = cap > 0 ? cap : 1;
+    snprintf(store->dir, sizeof(store->dir), "%s", dir);
+    store->seed = seed;
+    store->index_len = 2;
+    while (store->index_len < 2 * store->cap)
+        store->index_len *= 2;
+
+    store->ids = calloc(store->cap, sizeof(*store->ids));
+    store->last_used = calloc(store->cap, sizeof(*store->last_used));
+    store->boards = calloc(store->cap, sizeof(*store->boards));
+    store->histories = calloc(store->cap, sizeof(*store->histories));
+    store->cursors = calloc(store->cap, sizeof(*store->cursors));
+    store->editing_notes = calloc(store->cap, sizeof(*store->editing_notes));
+    store->free_slots = calloc(store->cap, sizeof(*store->free_slots));
+    store->index_ids = calloc(store->index_len, sizeof(*store->index_ids));
+    store->index_slots = calloc(store->index_len, sizeof(*store->index_slots));
+    if (store->ids == NULL || store->last_used == NULL || store->boards == NULL ||
+        store->histories == NULL || store->cursors == NULL || store->editing_notes == NULL ||
+        store->free_slots == NULL || store->index_ids == NULL || store->index_slots == NULL) {
+        session_store_free(store);
+        return NULL;
+    }
+
+    // Slot 0 is taken first
+    for (int i = 0; i < store->cap; i++)
+        store->free_slots[i] = store->cap - 1 - i;
+    store->free_len = store->cap;
+    for (int i = 0; i < store->index_len; i++)
+        store->index_slots[i] = SESSION_NO_SLOT;
+
+    return store;
+}
+
+// Free the store and the sessions in memory, without writing them to disk
+// (see session_evict_idle())
+void session_store_free(struct SessionStore *store)
+{
+    if (store->histories != NULL) {
+        for (int i = 0; i < store->cap; i++)
+            history_free(&store->histories[i]);
+    }
+    free(store->ids);
+    free(store->last_used);
+    free(store->boards);
+    free(store->histories);
+    free(store->cursors);
+    free(store->editing_notes);
+    free(store->free_slots);
+    free(store->index_ids);
+    free(store->index_slots);
+    free(store);
+}
+
+// Sessions in memory
+int session_store_len(const struct SessionStore *store)
+{
+    return store->len;
+}
+
+// A free slot, made by writing the least recently used session to disk if
+// there is none. -1 if that failed.
+static int take_slot(struct SessionStore *store)
+{
+    if (store->free_len == 0) {
+        int oldest = 0;
+        for (int i = 1; i < store->cap; i++) {
+            if (store->last_used[i] < store->last_used[oldest])
+                oldest = i;
+        }
+        if (!evict(store, oldest))
+            return -1;
+    }
+
+    int slot = store->free_slots[--store->free_len];
+    store->len++;
+    return slot;
+}
+
+static void release_slot(struct SessionStore *store, int slot)
+{
+    index_remove(store, store->ids[slot]);
+    store->ids[slot] = 0;
+    history_free(&store->histories[slot]);
+    store->free_slots[store->free_len++] = slot;
+    store->len--;
+}
+
+// Write a session to its file and free its slot. The file is a save file of
+// the game (see savestate()) with a line "cursor CELL NOTES" after it.
+static bool evict(struct SessionStore *store, int slot)
+{
+    char path[SESSION_PATH_LEN];
+    session_path(store, store->ids[slot], path);
+
+    FILE *out = fopen(path, "w");
+    if (out == NULL)
+        return false;
+
+    board_write(&store->boards[slot], out);
+    history_write(&store->histories[slot], out);
+    fprintf(out, "cursor %d %d\n", store->cursors[slot], store->editing_notes[slot]);
+
+    if (fclose(out) != 0) {
+        unlink(path);
+        return false;
+    }
+    release_slot(store, slot);
+    return true;
+}
+
+// Write the sessions that were not used for 'idle_ns' to disk, all of them
+// with 0. Returns how many were written, sessions that could not be written
+// stay in memory.
+int session_evict_idle(struct SessionStore *store, long long idle_ns)
+{
+    long long now = monotonic_ns();
+    int evicted = 0;
+
+    for (int i = 0; i < store->cap; i++) {
+        if (store->ids[i] != 0 && now - store->last_used[i] >= idle_ns && evict(store, i))
+            evicted++;
+    }
+    return evicted;
+}
+
+// Read a session back from its file into a slot, removing the file
+static enum SessionResult load(struct SessionStore *store, uint64_t id, int *slot)
+{
+    char path[SESSION_PATH_LEN];
+    session_path(store, id, path);
+
+    FILE *in = fopen(path, "r");
+    if (in == NULL)
+        return errno == ENOENT ? SESSION_UNKNOWN : SESSION_FAILED;
+
+    struct SudokuSpec board;
+    struct History history;
+    history_init(&history);
+    int cursor = 0, editing_notes = 0;
+    bool read = board_read(&board, in);
+    // A history that does not fit the game is dropped, as with '-f'
+    if (read && !history_read(&history, &board, in))
+        history_clear(&history);
+    if (read && fscanf(in, " cursor %d %d", &cursor, &editing_notes) == 2 &&
+        (cursor < 0 || cursor >= SUDOKU_LEN))
+        cursor = 0;
+    fclose(in);
+
+    if (!read || (*slot = take_slot(store)) < 0) {
+        history_free(&history);
+        return SESSION_FAILED;
+    }
+    unlink(path);
+
+    store->ids[*slot] = id;
+    store->boards[*slot] = board;
+    store->histories[*slot] = history;
+    store->cursors[*slot] = cursor;
+    store->editing_notes[*slot] = editing_notes != 0;
+    int at = index_find(store, id);
+    store->index_ids[at] = id;
+    store->index_slots[at] = *slot;
+    return SESSION_OK;
+}
+
+// The slot of a session, read from disk if it is not in memory
+static enum SessionResult lookup(struct SessionStore *store, uint64_t id, int *slot)
+{
+    if (id == 0)
+        return SESSION_UNKNOWN;
+
+    enum SessionResult result = SESSION_OK;
+    int at = index_find(store, id);
+    if (store->index_slots[at] != SESSION_NO_SLOT)
+        *slot = store->index_slots[at];
+    else
+        result = load(store, id, slot);
+
+    if (result == SESSION_OK)
+        store->last_used[*slot] = monotonic_ns();
+    return result;
+}
+
+// A cell (0-80) for a move
+static enum SessionResult check_cell(int cell)
+{
+    if (cell < 0 || cell >= SUDOKU_LEN)
+        return SESSION_INVALID;
+    return SESSION_OK;
+}
+
+// A cell and a digit (1-9) for a move that writes one
+static enum SessionResult check_digit(int cell, int digit)
+{
+    if (digit < 1 || digit > LINE_LEN)
+        return SESSION_INVALID;
+    return check_cell(cell);
+}
+
+// Start a session playing 'board', false if it could not be given a slot
+bool session_create(struct SessionStore *store, const struct SudokuSpec *board, uint64_t *id)
+{
+    char path[SESSION_PATH_LEN];
+
+    // Skip ids of sessions left on disk by an earlier run with the same seed
+    do {
+        *id = mix_id(store->seed + ++store->created);
+        session_path(store, *id, path);
+    } while (*id == 0 || store->index_slots[index_find(store, *id)] != SESSION_NO_SLOT ||
+             access(path, F_OK) == 0);
+
+    int slot = take_slot(store);
+    if (slot < 0)
+        return false;
+
+    store->ids[slot] = *id;
+    store->last_used[slot] = monotonic_ns();
+    store->boards[slot] = *board;
+    store->cursors[slot] = 0;
+    store->editing_notes[slot] = false;
+    int at = index_find(store, *id);
+    store->index_ids[at] = *id;
+    store->index_slots[at] = slot;
+    return true;
+}
+
+// Forget a session, in memory or on disk
+enum SessionResult session_end(struct SessionStore *store, uint64_t id)
+{
+    int slot;
+    enum SessionResult result = lookup(store, id, &slot);
+    if (result == SESSION_OK)
+        release_slot(store, slot);
+    return result;
+}
+
+// Copy out the board of a session and, if 'view' is not NULL, its cursor
+enum SessionResult session_get(struct SessionStore *store, uint64_t id, struct SudokuSpec *board,
+                               struct SessionView *view)
+{
+    int slot;
+    enum SessionResult result = lookup(store, id, &slot);
+    if (result != SESSION_OK)
+        return result;
+
+    *board = store->boards[slot];
+    if (view != NULL) {
+        view->cursor = store->cursors[slot];
+        view->editing_notes = store->editing_notes[slot];
+    }
+    return SESSION_OK;
+}
+
+// Put the cursor of a session on 'cell', as the keys that move it do
+enum SessionResult session_move(struct SessionStore *store, uint64_t id, int cell)
+{
+    int slot;
+    enum SessionResult result = check_cell(cell);
+    if (result == SESSION_OK)
+        result = lookup(store, id, &slot);
+    if (result == SESSION_OK)
+        store->cursors[slot] = cell;
+    return result;
+}
+
+// Switch between entering numbers and notes, only kept for the client
+enum SessionResult session_set_note_mode(struct SessionStore *store, uint64_t id, bool editing_notes)
+{
+    int slot;
+    enum SessionResult result = lookup(store, id, &slot);
+    if (result == SESSION_OK)
+        store->editing_notes[slot] = editing_notes;
+    return result;
+}
+
+// The moves work like their keys in the game (see game.c) on 'cell', and
+// leave the cursor there
+enum SessionResult session_insert(struct SessionStore *store, uint64_t id, int cell, int digit)
+{
+    int slot;
+    enum SessionResult result = check_digit(cell, digit);
+    if (result == SESSION_OK)
+        result = lookup(store, id, &slot);
+    if (result != SESSION_OK)
+        return result;
+
+    struct History *history = &store->histories[slot];
+    store->cursors[slot] = cell;
+    return game_insert(&store->boards[slot], history, cell, digit) ? SESSION_OK : SESSION_UNCHANGED;
+}
+
+enum SessionResult session_erase(struct SessionStore *store, uint64_t id, int cell)
+{
+    int slot;
+    enum SessionResult result = check_cell(cell);
+    if (result == SESSION_OK)
+        result = lookup(store, id, &slot);
+    if (result != SESSION_OK)
+        return result;
+
+    struct History *history = &store->histories[slot];
+    store->cursors[slot] = cell;
+    return game_erase(&store->boards[slot], history, cell) ? SESSION_OK : SESSION_UNCHANGED;
+}
+
+enum SessionResult session_toggle_note(struct SessionStore *store, uint64_t id, int cell, int digit)
+{
+    int slot;
+    enum SessionResult result = check_digit(cell, digit);
+    if (result == SESSION_OK)
+        result = lookup(store, id, &slot);
+    if (result != SESSION_OK)
+        return result;
+
+    struct History *history = &store->histories[slot];
+    store->cursors[slot] = cell;
+    return game_toggle_note(&store->boards[slot], history, cell, digit) ? SESSION_OK
+                                                                        : SESSION_UNCHANGED;
+}
+
+// Undo the last move, moving the cursor to its cell ('cell')
+enum SessionResult session_undo(struct SessionStore *store, uint64_t id, int *cell)
+{
+    int slot;
+    enum SessionResult result = lookup(store, id, &slot);
+    if (result != SESSION_OK)
+        return result;
+    *cell = history_undo(&store->histories[slot], &store->boards[slot]);
+    if (*cell < 0)
+        return SESSION_UNCHANGED;
+    store->cursors[slot] = *cell;
+    return SESSION_OK;
+}
+
+enum SessionResult session_redo(struct SessionStore *store, uint64_t id, int *cell)
+{
+    int slot;
+    enum SessionResult result = lookup(store, id, &slot);
+    if (result != SESSION_OK)
+        return result;
+    *cell = history_redo(&store->histories[slot], &store->boards[slot]);
+    if (*cell < 0)
+        return SESSION_UNCHANGED;
+    store->cursors[slot] = *cell;
+    return SESSION_OK;
+}
+
+// Fill out the grid of a session with 'grid', solved from the copy of its
+// board in 'seen', as one move to undo. Solving takes long, so it happens
+// without the session: if it was played on in the meantime, nothing changes.
+enum SessionResult session_fill(struct SessionStore *store, uint64_t id, const struct SudokuSpec *seen,
+                                const char *grid)
+{
+    int slot;
+    enum SessionResult result = lookup(store, id, &slot);
+    if (result != SESSION_OK)
+        return result;
+
+    const struct SudokuSpec *board = &store->boards[slot];
+    if (memcmp(board->digits, seen->digits, sizeof(board->digits)) != 0 ||
+        memcmp(board->notes, seen->notes, sizeof(board->notes)) != 0)
+        return SESSION_CHANGED;
+
+    struct History *history = &store->histories[slot];
+    game_fill(&store->boards[slot], history, grid);
+    return SESSION_OK;
+}
+
+const char *session_result_text(enum SessionResult result)
+{
+    switch (result) {
+    case SESSION_OK:
+        return "ok";
+    case SESSION_UNCHANGED:
+        return "unchanged";
+    case SESSION_UNKNOWN:
+        return "unknown session";
+    case SESSION_INVALID:
+        return "invalid cell or digit";
+    case SESSION_NO_SOLUTION:
+        return "no solution";
+    case SESSION_CHANGED:
+        return "changed while solving";
+    default:
+        return "failed";
+    }
+}
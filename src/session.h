@@ -0,0 +1,70 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "board.h"
+#include "sudoku.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// What became of an operation on a session
+enum SessionResult {
+    SESSION_OK,
+    // Nothing changed: a clue, a digit already there, nothing to undo
+    SESSION_UNCHANGED,
+    // No session with that id, in memory or on disk
+    SESSION_UNKNOWN,
+    // A cell or digit out of range
+    SESSION_INVALID,
+    // The numbers entered leave no solution
+    SESSION_NO_SOLUTION,
+    // Another move came in while the session was being solved
+    SESSION_CHANGED,
+    // Out of memory, or the session could not be read from disk
+    SESSION_FAILED,
+};
+
+// Where the cursor of a session is and what the keys do there
+struct SessionView {
+    int cursor;
+    bool editing_notes;
+};
+
+struct SessionStore;
+
+struct SessionStore *session_store_new(int cap, const char *dir, unsigned long long seed);
+void session_store_free(struct SessionStore *store);
+int session_store_len(const struct SessionStore *store);
+int session_evict_idle(struct SessionStore *store, long long idle_ns);
+
+bool session_create(struct SessionStore *store, const struct SudokuSpec *board, uint64_t *id);
+enum SessionResult session_end(struct SessionStore *store, uint64_t id);
+enum SessionResult session_get(struct SessionStore *store, uint64_t id, struct SudokuSpec *board,
+                               struct SessionView *view);
+enum SessionResult session_move(struct SessionStore *store, uint64_t id, int cell);
+enum SessionResult session_set_note_mode(struct SessionStore *store, uint64_t id, bool editing_notes);
+enum SessionResult session_insert(struct SessionStore *store, uint64_t id, int cell, int digit);
+enum SessionResult session_erase(struct SessionStore *store, uint64_t id, int cell);
+enum SessionResult session_toggle_note(struct SessionStore *store, uint64_t id, int cell, int digit);
+enum SessionResult session_undo(struct SessionStore *store, uint64_t id, int *cell);
+enum SessionResult session_redo(struct SessionStore *store, uint64_t id, int *cell);
+enum SessionResult session_fill(struct SessionStore *store, uint64_t id, const struct SudokuSpec *seen,
+                                const char *grid);
+const char *session_result_text(enum SessionResult result);
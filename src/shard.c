@@ -0,0 +1,72 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Generate one shard of a global sequence of puzzles ('--shard I/N') and write
+// it to stdout. Puzzle K of the sequence only depends on the seed, K and the
+// options of the generator, and shard I makes those with K % N == I: shards
+// never overlap, and running one again writes the same bytes. Each line holds
+// K, the puzzle and its grade; the time each puzzle took goes to stderr, as it
+// depends on the machine. sudoku-merge puts the shards back together.
+
+#include "shard.h"
+#include "util.h"
+
+#include <stdio.h>
+
+int shard_generate(const struct TSOpts *opts)
+{
+    struct SudokuCtx *ctx = sudoku_ctx_new();
+    if (ctx == NULL) {
+        perror("Allocating solver");
+        return 1;
+    }
+    sudoku_ctx_set_attempts(ctx, opts->attempts);
+    sudoku_ctx_set_threads(ctx, opts->threads);
+    sudoku_ctx_set_speculation(ctx, opts->speculate);
+    sudoku_ctx_set_difficulty(ctx, opts->difficulty);
+    sudoku_ctx_set_minimal(ctx, opts->minimal);
+    sudoku_ctx_set_variant(ctx, opts->variant);
+
+    // Everything after the shard is the same for all shards of a sequence,
+    // sudoku-merge only combines shards that agree on it
+    printf("# shard %d/%d seed %llu puzzles %llu -n %d --speculate %d --difficulty %s --variant %s%s\n",
+           opts->shard_index, opts->shard_count, opts->seed, opts->puzzles, opts->attempts,
+           opts->speculate, sudoku_grade_name(opts->difficulty), sudoku_variant_name(opts->variant),
+           opts->minimal ? " --minimal" : "");
+
+    for (unsigned long long k = opts->shard_index; k < opts->puzzles; k += opts->shard_count) {
+        char puzzle[SUDOKU_LEN];
+
+        // Seeded apart like the workers of the server
+        sudoku_ctx_seed(ctx, opts->seed + k * 0x9e3779b97f4a7c15ULL);
+        long long start = monotonic_ns();
+        sudoku_generate(ctx, puzzle);
+        double generate_ms = (monotonic_ns() - start) / 1e6;
+        printf("%llu %.*s %s\n", k, SUDOKU_LEN, puzzle, sudoku_grade_name(sudoku_grade(ctx, puzzle)));
+        fprintf(stderr, "puzzle %llu: %.1f ms\n", k, generate_ms);
+    }
+    if (opts->stats != STATS_OFF)
+        stats_print(ctx, opts->stats);
+    sudoku_ctx_free(ctx);
+
+    if (fflush(stdout) != 0) {
+        perror("Writing puzzles");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "main.h"
+
+// Longest header line of a shard file, see shard_generate()
+#define SHARD_HEADER_LEN 256
+// Longest name of a grade in the lines of a shard file, with the NUL
+#define SHARD_GRADE_LEN 16
+
+int shard_generate(const struct TSOpts *opts);
@@ -0,0 +1,117 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Reports of the counters libsudoku keeps when built with SUDOKU_STATS: a
+// summary printed to stderr on exit or at the end of a batch ('--stats') and a short line for the
+// debug status line of the game.
+
+#include "stats.h"
+
+#include "sudoku.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct {
+    const struct SudokuCtx *ctx;
+    enum StatsFormat format;
+} report;
+
+static const char *phase_names[SUDOKU_PHASE_COUNT] = {
+    [SUDOKU_PHASE_FILL] = "fill",
+    [SUDOKU_PHASE_REMOVE] = "remove",
+    [SUDOKU_PHASE_SOLVE] = "solve",
+};
+
+void stats_print_report(void);
+
+// Read the argument of '--stats', NULL meaning the default
+bool stats_parse_format(const char *name, enum StatsFormat *format)
+{
+    if (name == NULL || strcmp(name, "text") == 0)
+        *format = STATS_TEXT;
+    else if (strcmp(name, "json") == 0)
+        *format = STATS_JSON;
+    else
+        return false;
+
+    return true;
+}
+
+void stats_report_at_exit(const struct SudokuCtx *ctx, enum StatsFormat format)
+{
+    report.ctx = ctx;
+    report.format = format;
+    atexit(stats_print_report);
+}
+
+void stats_print_report(void)
+{
+    stats_print(report.ctx, report.format);
+}
+
+// Print the counters to stderr, for modes that free their context before exit
+void stats_print(const struct SudokuCtx *ctx, enum StatsFormat format)
+{
+    struct SudokuStats st;
+    sudoku_ctx_get_stats(ctx, &st);
+
+    if (format == STATS_JSON) {
+        fprintf(stderr,
+                "{\"nodes\": %llu, \"backtracks\": %llu, \"max_depth\": %d, "
+                "\"solution_counts\": %llu, \"validity_checks\": %llu, "
+                "\"removals_accepted\": %llu, \"removals_rejected\": %llu",
+                st.nodes, st.backtracks, st.max_depth, st.solution_counts,
+                st.validity_checks, st.removals_accepted, st.removals_rejected);
+        for (int i = 0; i < SUDOKU_PHASE_COUNT; i++)
+            fprintf(stderr, ", \"%s_ms\": %.3f", phase_names[i], st.phase_ns[i] / 1e6);
+        fprintf(stderr, "}\n");
+        return;
+    }
+
+    fprintf(stderr,
+            "nodes              %llu\n"
+            "backtracks         %llu\n"
+            "max depth          %d\n"
+            "solution counts    %llu\n"
+            "validity checks    %llu\n"
+            "removals accepted  %llu\n"
+            "removals rejected  %llu\n",
+            st.nodes, st.backtracks, st.max_depth, st.solution_counts,
+            st.validity_checks, st.removals_accepted, st.removals_rejected);
+    for (int i = 0; i < SUDOKU_PHASE_COUNT; i++) {
+        char label[32];
+        snprintf(label, sizeof(label), "%s time (ms)", phase_names[i]);
+        fprintf(stderr, "%-18s %.3f\n", label, st.phase_ns[i] / 1e6);
+    }
+}
+
+// Summary of the counters so far that fits into the status bar
+void stats_format_line(const struct SudokuCtx *ctx, char *line, size_t sz)
+{
+    struct SudokuStats st;
+    sudoku_ctx_get_stats(ctx, &st);
+
+    snprintf(line, sz, "n=%llu bt=%llu d=%d rm=%llu/%llu t=%.1f/%.1f/%.1fms",
+             st.nodes, st.backtracks, st.max_depth, st.removals_accepted,
+             st.removals_accepted + st.removals_rejected,
+             st.phase_ns[SUDOKU_PHASE_FILL] / 1e6, st.phase_ns[SUDOKU_PHASE_REMOVE] / 1e6,
+             st.phase_ns[SUDOKU_PHASE_SOLVE] / 1e6);
+}
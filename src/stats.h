@@ -0,0 +1,35 @@
+/*
+term-sudoku: play sudoku in the terminal
+Copyright (C) 2024 eyeofcthulhu
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct SudokuCtx;
+
+enum StatsFormat {
+    STATS_OFF,
+    STATS_TEXT,
+    STATS_JSON,
+};
+
+bool stats_parse_format(const char *name, enum StatsFormat *format);
+void stats_report_at_exit(const struct SudokuCtx *ctx, enum StatsFormat format);
+void stats_print(const struct SudokuCtx *ctx, enum StatsFormat format);
+void stats_format_line(const struct SudokuCtx *ctx, char *line, size_t sz);
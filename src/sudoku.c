@@ -18,77 +18,706 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "sudoku.h"
 
-#include "main.h"
-#include "ncurses_render.h"
-#include "util.h"
+#include "probes.h"
 
-#include <curses.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-void solve_count(char *sudoku_to_solve, int *count);
-void remove_nums(char *gen_sudoku, const struct TSOpts *opts);
+#define CHNUM(x) ((x) - 0x30)
 
-#define COLUMN(sudoku, cell, i) ((sudoku)[(i) * LINE_LEN + ((cell) % LINE_LEN)])
-#define ROW(sudoku, cell, i) ((sudoku)[((cell) / LINE_LEN) * LINE_LEN + (i)])
-#define BLOCK(sudoku, cell, i) ((sudoku)[((((cell) / LINE_LEN) / 3) * 3) * LINE_LEN + \
-                                         ((((cell) % LINE_LEN) / 3) * 3) + \
-                                         (LINE_LEN * ((i) / 3)) + ((i) % 3)])
+// The rules of a variant as tables: every unit holds each digit once, and the
+// peers of a cell are all cells that may not have the same digit
+#define UNITS_MAX (3 * LINE_LEN + 4)
+#define CELL_UNITS_MAX 5
+#define PEERS_MAX 32
+#define OVERLAPS_MAX 192
 
-// Generate a random sudoku
-// This function generates the diagonal blocks from left to right and then calls
-// solve() and remove_nums() to first fill out and then remove some numbers to
-// create a complete puzzle
-void generate_sudoku(char *gen_sudoku, const struct TSOpts *opts)
-{
-    if (opts->gen_visual)
-        curs_set(0);
-    // Fill each diagonal block with the values 1-9
-    /* [x][ ][ ]
-     * [ ][x][ ]
-     * [ ][ ][x] */
-    for (int i = 0; i < 3; i++) {
-        bool used[LINE_LEN] = { false };
+struct Constraints {
+    unsigned char units[UNITS_MAX][LINE_LEN];
+    int units_len;
+    unsigned char cell_units[SUDOKU_LEN][CELL_UNITS_MAX];
+    unsigned char cell_units_len[SUDOKU_LEN];
+    // The same as one bit per unit, for telling at once whether a cell is in one
+    unsigned cell_unit_bits[SUDOKU_LEN];
+    unsigned char peers[SUDOKU_LEN][PEERS_MAX];
+    unsigned char peers_len[SUDOKU_LEN];
+    // Pairs of units that share two cells or more, for locked candidates
+    unsigned char overlaps[OVERLAPS_MAX][2];
+    int overlaps_len;
+    // Some peers share no unit with their cell (anti-king, anti-knight), so
+    // complete units do not make a grid valid
+    bool loose;
+};
 
-        for (int j = 0; j < LINE_LEN; j++) {
-            int num;
-            do {
-                num = rand() % 9;
-            } while (used[num]);
+// The tables of the standard grid, worked out by the compiler. The units are
+// the rows, then the columns, then the blocks. The peers of a cell are the
+// other cells of its column, then of its row, then the four cells of its block
+// on neither.
+#define STD_ROW(c) ((c) / LINE_LEN)
+#define STD_COL(c) ((c) % LINE_LEN)
+#define STD_BLOCK(c) (STD_ROW(c) / 3 * 3 + STD_COL(c) / 3)
+#define STD_BLOCK_CELL(b, i) (((b) / 3 * 3 + (i) / 3) * LINE_LEN + (b) % 3 * 3 + (i) % 3)
+#define STD_COL_PEER(c, k) (((k) + ((k) >= STD_ROW(c))) * LINE_LEN + STD_COL(c))
+#define STD_ROW_PEER(c, k) (STD_ROW(c) * LINE_LEN + (k) + ((k) >= STD_COL(c)))
+#define STD_BLOCK_PEER(c, i, j) ((STD_ROW(c) / 3 * 3 + (STD_ROW(c) % 3 + (i)) % 3) * LINE_LEN + \
+                                 STD_COL(c) / 3 * 3 + (STD_COL(c) % 3 + (j)) % 3)
 
-            used[num] = true;
+#define STD_ROW_UNIT(r) { (r) * 9, (r) * 9 + 1, (r) * 9 + 2, (r) * 9 + 3, (r) * 9 + 4, \
+                          (r) * 9 + 5, (r) * 9 + 6, (r) * 9 + 7, (r) * 9 + 8 }
+#define STD_COL_UNIT(c) { (c), 9 + (c), 18 + (c), 27 + (c), 36 + (c), 45 + (c), 54 + (c), 63 + (c), 72 + (c) }
+#define STD_BLOCK_UNIT(b) { STD_BLOCK_CELL(b, 0), STD_BLOCK_CELL(b, 1), STD_BLOCK_CELL(b, 2), \
+                            STD_BLOCK_CELL(b, 3), STD_BLOCK_CELL(b, 4), STD_BLOCK_CELL(b, 5), \
+                            STD_BLOCK_CELL(b, 6), STD_BLOCK_CELL(b, 7), STD_BLOCK_CELL(b, 8) }
+#define STD_CELL_UNITS(c) { STD_ROW(c), LINE_LEN + STD_COL(c), 2 * LINE_LEN + STD_BLOCK(c) }
+#define STD_PEERS(c) { STD_COL_PEER(c, 0), STD_COL_PEER(c, 1), STD_COL_PEER(c, 2), STD_COL_PEER(c, 3), \
+                       STD_COL_PEER(c, 4), STD_COL_PEER(c, 5), STD_COL_PEER(c, 6), STD_COL_PEER(c, 7), \
+                       STD_ROW_PEER(c, 0), STD_ROW_PEER(c, 1), STD_ROW_PEER(c, 2), STD_ROW_PEER(c, 3), \
+                       STD_ROW_PEER(c, 4), STD_ROW_PEER(c, 5), STD_ROW_PEER(c, 6), STD_ROW_PEER(c, 7), \
+                       STD_BLOCK_PEER(c, 1, 1), STD_BLOCK_PEER(c, 1, 2), \
+                       STD_BLOCK_PEER(c, 2, 1), STD_BLOCK_PEER(c, 2, 2) }
+#define STD_PEERS_LEN(c) 20
+#define STD_CELL_UNITS_LEN(c) 3
+#define STD_CELL_UNIT_BITS(c) (1u << STD_ROW(c) | 1u << (LINE_LEN + STD_COL(c)) | \
+                               1u << (2 * LINE_LEN + STD_BLOCK(c)))
+// A block with the three rows, then the three columns through it
+#define STD_OVERLAPS(b) { 18 + (b), (b) / 3 * 3 }, { 18 + (b), (b) / 3 * 3 + 1 }, \
+                        { 18 + (b), (b) / 3 * 3 + 2 }, { 18 + (b), 9 + (b) % 3 * 3 }, \
+                        { 18 + (b), 9 + (b) % 3 * 3 + 1 }, { 18 + (b), 9 + (b) % 3 * 3 + 2 }
 
-            gen_sudoku[(i * 3) * LINE_LEN + (i * 3) +
-                       (LINE_LEN * (j / 3)) + (j % 3)] = '1' + num;
+#define STD_CELL(c) (c)
+#define STD_NINE(m) m(0), m(1), m(2), m(3), m(4), m(5), m(6), m(7), m(8)
+#define STD_ROW_CELLS(m, r) m((r) * 9), m((r) * 9 + 1), m((r) * 9 + 2), m((r) * 9 + 3), m((r) * 9 + 4), \
+                            m((r) * 9 + 5), m((r) * 9 + 6), m((r) * 9 + 7), m((r) * 9 + 8)
+#define STD_CELLS(m) STD_ROW_CELLS(m, 0), STD_ROW_CELLS(m, 1), STD_ROW_CELLS(m, 2), \
+                     STD_ROW_CELLS(m, 3), STD_ROW_CELLS(m, 4), STD_ROW_CELLS(m, 5), \
+                     STD_ROW_CELLS(m, 6), STD_ROW_CELLS(m, 7), STD_ROW_CELLS(m, 8)
 
-            // Draw the process of filling out the sudoku visually on the screen
-            // if that option is set via '-v'
-            if (opts->gen_visual) {
-                generate_visually(gen_sudoku);
-            }
+// The regions of SUDOKU_VARIANT_JIGSAW
+static const char jigsaw_regions[SUDOKU_LEN + 1] =
+    "000111222"
+    "000111222"
+    "003411522"
+    "033441552"
+    "333444555"
+    "633447855"
+    "663747885"
+    "666777888"
+    "666777888";
+
+// The tables of the other variants are built from the regions by
+// build_variants() the first time a context switches to one
+static struct Constraints variants[SUDOKU_VARIANT_COUNT] = {
+    [SUDOKU_VARIANT_STANDARD] = {
+        .units = { STD_NINE(STD_ROW_UNIT), STD_NINE(STD_COL_UNIT), STD_NINE(STD_BLOCK_UNIT) },
+        .units_len = 3 * LINE_LEN,
+        .cell_units = { STD_CELLS(STD_CELL_UNITS) },
+        .cell_units_len = { STD_CELLS(STD_CELL_UNITS_LEN) },
+        .cell_unit_bits = { STD_CELLS(STD_CELL_UNIT_BITS) },
+        .peers = { STD_CELLS(STD_PEERS) },
+        .peers_len = { STD_CELLS(STD_PEERS_LEN) },
+        .overlaps = { STD_NINE(STD_OVERLAPS) },
+        .overlaps_len = 6 * LINE_LEN,
+        .loose = false,
+    },
+};
+static pthread_once_t variants_once = PTHREAD_ONCE_INIT;
+
+// The searches are compiled twice, with and without callbacks, so that the
+// variant without has no trace of them
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+// Parallel counting: the search is split into at least this many tasks per
+// thread, by filling in at most POOL_SPLIT_DEPTH empty cells
+#define POOL_TASKS_PER_THREAD 16
+#define POOL_SPLIT_DEPTH 6
+// Interval at which a caller with callbacks wakes up while the pool counts
+#define POOL_POLL_NS 1000000LL
+
+// Nodes after which fill_grid() starts over
+#define FILL_RESTART_NODES 256
+
+// Unavoidable sets remove_nums_minimal() keeps at most
+#define MINIMAL_SETS_MAX 256
+
+// Components sudoku_count_exact() remembers the count of, and the most empty
+// cells one may have to be remembered
+#define EXACT_CACHE_LEN (1 << 15)
+#define EXACT_CACHE_CELLS SUDOKU_LEN
+// Cells in a band of three rows
+#define BAND_LEN (3 * LINE_LEN)
+
+// Counters for --stats, compiled out unless SUDOKU_STATS is defined
+#ifdef SUDOKU_STATS
+#define STAT(ctx, update) ((ctx)->stats.update)
+#else
+#define STAT(ctx, update) ((void)0)
+#endif
+
+struct SudokuCtx {
+    unsigned long long rng;
+    int attempts;
+    // Time budget of the generation, 0 for none
+    long long budget_ns;
+    // Monotonic time at which the running generation has to stop, 0 for none
+    long long deadline;
+
+    SudokuStepCallback step;
+    void *step_user;
+    SudokuProgressCallback progress;
+    void *progress_user;
+    struct SudokuProgress progress_state;
+    // The progress callback cancelled the running operation
+    bool cancelled;
+    // The deadline passed during the running operation
+    bool expired;
+
+    // Threads for counting solutions, the pool is started on first use
+    int threads;
+    // Clues remove_nums_speculative() tries at once, 1 for remove_nums()
+    int speculate;
+    // Grade sudoku_generate() aims for, SUDOKU_GRADE_NONE for any
+    enum SudokuGrade difficulty;
+    // sudoku_generate() removes clues until none can go
+    bool minimal;
+    // The rules grids are checked against, from variants[]
+    enum SudokuVariant variant;
+    const struct Constraints *constraints;
+    struct CountPool *pool;
+    // Contexts of pool threads: give up the current count once this is set
+    atomic_bool *abandon;
+    // Counts of components sudoku_count_exact() has seen, allocated on first
+    // use and kept for later counts under the same rules
+    struct ExactEntry *exact_cache;
+    const struct Constraints *exact_rules;
+
+#ifdef SUDOKU_STATS
+    struct SudokuStats stats;
+    int stats_depth;
+    long long stats_phase_start;
+#endif
+};
+
+// A set of cells, one bit per cell
+struct CellSet {
+    unsigned long long bits[2];
+};
+
+// Threads counting the solutions of one puzzle together. The caller splits the
+// search into tasks, the threads take them one by one and add up the solutions
+// they find until there are two.
+struct CountPool {
+    int len;
+    pthread_t *threads;
+    // One private context per thread
+    struct SudokuCtx *workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    // Incremented for every count, threads wait for it to change
+    unsigned round;
+    // Threads still busy with the current round
+    int running;
+    bool quit;
+
+    // Partial grids to search, and the buffer for splitting them further
+    char (*tasks)[SUDOKU_LEN];
+    // Where to store the count of each task separately, NULL to add them up
+    int *results;
+    char (*split)[SUDOKU_LEN];
+    size_t tasks_len;
+    size_t tasks_cap;
+
+    // The caller shows progress, so the threads publish their nodes as they go
+    bool report;
+    atomic_size_t next_task;
+    atomic_int found;
+    atomic_bool stop;
+    atomic_ullong nodes;
+};
+
+// How a search picks its guesses
+enum Guess {
+    // The first empty cell, its digits in order: the first solution found is
+    // the one plain backtracking would find
+    GUESS_FIRST,
+    // The empty cell with the fewest candidates, its digits in order
+    GUESS_FEWEST,
+};
+
+struct Grading;
+static void search_plain(struct SudokuCtx *ctx, struct Grading *g, int *found, int limit, enum Guess guess);
+static void search_hooked(struct SudokuCtx *ctx, struct Grading *g, int *found, int limit, enum Guess guess);
+static int search_grid(struct SudokuCtx *ctx, char *sudoku, int limit, enum Guess guess, bool hooks);
+static bool fill_grid(struct SudokuCtx *ctx, char *gen_sudoku);
+struct ExactCount;
+static unsigned long long count_split(struct SudokuCtx *ctx, struct ExactCount *ec,
+                                      const unsigned char *cells, int len,
+                                      unsigned long long limit, bool hooks);
+static void count_solutions(struct SudokuCtx *ctx, char *sudoku, int *count, bool hooks);
+static void pool_free(struct CountPool *pool);
+static void remove_nums(struct SudokuCtx *ctx, char *gen_sudoku);
+static void remove_nums_until_deadline(struct SudokuCtx *ctx, char *gen_sudoku);
+static void remove_nums_speculative(struct SudokuCtx *ctx, char *gen_sudoku);
+static enum SudokuGrade remove_nums_graded(struct SudokuCtx *ctx, char *gen_sudoku);
+static void remove_nums_minimal(struct SudokuCtx *ctx, char *gen_sudoku);
+static enum SudokuGrade grade_up_to(const struct Constraints *rules, const char *sudoku,
+                                    enum SudokuGrade limit, char *deduced);
+static int find_unavoidable_sets(const struct Constraints *rules, const char *solution,
+                                 struct CellSet *sets, int cap);
+static bool has_other_solution(struct SudokuCtx *ctx, const char *sudoku, int cell, int digit, bool hooks);
+static void count_each(struct SudokuCtx *ctx, char (*grids)[SUDOKU_LEN], int len, int *counts, bool hooks);
+static void build_variants(void);
+
+struct SudokuCtx *sudoku_ctx_new(void)
+{
+    struct SudokuCtx *ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL)
+        return NULL;
+
+    ctx->attempts = SUDOKU_ATTEMPTS_DEFAULT;
+    ctx->threads = 1;
+    ctx->speculate = 1;
+    ctx->constraints = &variants[SUDOKU_VARIANT_STANDARD];
+    sudoku_ctx_seed(ctx, 0);
+
+    return ctx;
+}
+
+void sudoku_ctx_free(struct SudokuCtx *ctx)
+{
+    if (ctx->pool != NULL)
+        pool_free(ctx->pool);
+    free(ctx->exact_cache);
+    free(ctx);
+}
+
+void sudoku_ctx_seed(struct SudokuCtx *ctx, unsigned long long seed)
+{
+    // xorshift must not start from zero
+    ctx->rng = seed ^ 0x9e3779b97f4a7c15ULL;
+    if (ctx->rng == 0)
+        ctx->rng = 1;
+}
+
+// Number of numbers to try and remove before giving up
+void sudoku_ctx_set_attempts(struct SudokuCtx *ctx, int attempts)
+{
+    ctx->attempts = attempts > 0 ? attempts : SUDOKU_ATTEMPTS_DEFAULT;
+}
+
+// Count solutions on 'threads' threads (1 for none). The result, and so the
+// generated puzzles, do not depend on it
+void sudoku_ctx_set_threads(struct SudokuCtx *ctx, int threads)
+{
+    if (threads < 1)
+        threads = 1;
+    if (threads > SUDOKU_THREADS_MAX)
+        threads = SUDOKU_THREADS_MAX;
+
+    if (ctx->pool != NULL && ctx->pool->len != threads) {
+        pool_free(ctx->pool);
+        ctx->pool = NULL;
+    }
+    ctx->threads = threads;
+}
+
+// Let sudoku_generate() try to remove 'candidates' clues at once, each
+// counted on a thread of its own (see sudoku_ctx_set_threads()), 1 turns it
+// off. The puzzles depend on the seed and 'candidates', not on the threads.
+void sudoku_ctx_set_speculation(struct SudokuCtx *ctx, int candidates)
+{
+    if (candidates < 1)
+        candidates = 1;
+    if (candidates > SUDOKU_SPECULATE_MAX)
+        candidates = SUDOKU_SPECULATE_MAX;
+
+    ctx->speculate = candidates;
+}
+
+// Let sudoku_generate() aim for puzzles of 'grade' (see sudoku_grade()),
+// SUDOKU_GRADE_NONE for any. The attempts, time budget and speculation do
+// not apply then.
+void sudoku_ctx_set_difficulty(struct SudokuCtx *ctx, enum SudokuGrade grade)
+{
+    ctx->difficulty = grade >= SUDOKU_GRADE_NONE && grade < SUDOKU_GRADE_COUNT ? grade : SUDOKU_GRADE_NONE;
+}
+
+// Let sudoku_generate() remove clues until none can go without making the
+// solution ambiguous. The attempts, time budget and speculation do not apply
+// then.
+void sudoku_ctx_set_minimal(struct SudokuCtx *ctx, bool minimal)
+{
+    ctx->minimal = minimal;
+}
+
+// Play 'variant' from now on: generating, solving and checking all follow its
+// rules
+void sudoku_ctx_set_variant(struct SudokuCtx *ctx, enum SudokuVariant variant)
+{
+    if (variant < SUDOKU_VARIANT_STANDARD || variant >= SUDOKU_VARIANT_COUNT)
+        variant = SUDOKU_VARIANT_STANDARD;
+
+    pthread_once(&variants_once, build_variants);
+    ctx->variant = variant;
+    ctx->constraints = &variants[variant];
+}
+
+// Let sudoku_generate() remove clues until 'budget_ms' have passed instead of
+// until the attempts are used up, 0 turns it off
+void sudoku_ctx_set_time_budget(struct SudokuCtx *ctx, unsigned budget_ms)
+{
+    ctx->budget_ns = budget_ms * 1000000LL;
+}
+
+void sudoku_ctx_set_step_callback(struct SudokuCtx *ctx, SudokuStepCallback callback, void *user)
+{
+    ctx->step = callback;
+    ctx->step_user = user;
+}
+
+void sudoku_ctx_set_progress_callback(struct SudokuCtx *ctx, SudokuProgressCallback callback, void *user)
+{
+    ctx->progress = callback;
+    ctx->progress_user = user;
+}
+
+// Whether the last operation was cancelled by the progress callback
+bool sudoku_cancelled(const struct SudokuCtx *ctx)
+{
+    return ctx->cancelled;
+}
+
+// Copy the counters of 'ctx', false if libsudoku was built without them
+bool sudoku_ctx_get_stats(const struct SudokuCtx *ctx, struct SudokuStats *stats)
+{
+#ifdef SUDOKU_STATS
+    *stats = ctx->stats;
+    return true;
+#else
+    (void)ctx;
+    memset(stats, 0, sizeof(*stats));
+    return false;
+#endif
+}
+
+void sudoku_ctx_reset_stats(struct SudokuCtx *ctx)
+{
+#ifdef SUDOKU_STATS
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+#else
+    (void)ctx;
+#endif
+}
+
+static bool has_hooks(const struct SudokuCtx *ctx)
+{
+    return ctx->step != NULL || ctx->progress != NULL || ctx->deadline != 0;
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// The running search has to be abandoned
+static bool stopped(const struct SudokuCtx *ctx)
+{
+    return ctx->cancelled || ctx->expired;
+}
+
+// xorshift64*: random number in [0, bound)
+static int random_below(struct SudokuCtx *ctx, int bound)
+{
+    ctx->rng ^= ctx->rng >> 12;
+    ctx->rng ^= ctx->rng << 25;
+    ctx->rng ^= ctx->rng >> 27;
+    return (int)(((ctx->rng * 0x2545f4914f6cdd1dULL) >> 33) % bound);
+}
+
+static void report_step(struct SudokuCtx *ctx, const char *sudoku)
+{
+    if (ctx->step != NULL)
+        ctx->step(sudoku, ctx->step_user);
+}
+
+static void begin_phase(struct SudokuCtx *ctx, enum SudokuPhase phase)
+{
+    ctx->progress_state.phase = phase;
+    ctx->progress_state.nodes = 0;
+    ctx->cancelled = false;
+    ctx->expired = false;
+#ifdef SUDOKU_STATS
+    ctx->stats_phase_start = now_ns();
+#endif
+}
+
+static void end_phase(struct SudokuCtx *ctx)
+{
+#ifdef SUDOKU_STATS
+    ctx->stats.phase_ns[ctx->progress_state.phase] += now_ns() - ctx->stats_phase_start;
+#else
+    (void)ctx;
+#endif
+}
+
+// Track the depth of the recursion around a call of a search
+static void enter_search(struct SudokuCtx *ctx)
+{
+#ifdef SUDOKU_STATS
+    if (++ctx->stats_depth > ctx->stats.max_depth)
+        ctx->stats.max_depth = ctx->stats_depth;
+#else
+    (void)ctx;
+#endif
+}
+
+static void leave_search(struct SudokuCtx *ctx)
+{
+#ifdef SUDOKU_STATS
+    ctx->stats_depth--;
+#else
+    (void)ctx;
+#endif
+}
+
+// Report progress every SUDOKU_PROGRESS_INTERVAL nodes and check the deadline
+// every SUDOKU_DEADLINE_INTERVAL nodes. False once the search is cancelled or
+// out of time
+static bool count_node(struct SudokuCtx *ctx)
+{
+    unsigned long long nodes = ctx->progress_state.nodes;
+
+    if (nodes % SUDOKU_PROGRESS_INTERVAL == 0 && ctx->progress != NULL &&
+        !ctx->progress(&ctx->progress_state, ctx->progress_user))
+        ctx->cancelled = true;
+
+    if (nodes % SUDOKU_DEADLINE_INTERVAL == 0 && ctx->deadline != 0 && now_ns() >= ctx->deadline)
+        ctx->expired = true;
+
+    return !stopped(ctx);
+}
+
+// Fill grids and remove clues from them with remove_nums_graded() until one
+// has the grade asked for. After SUDOKU_GRADE_TRIES grids the hardest one
+// is taken, none is harder than asked for.
+static void generate_graded(struct SudokuCtx *ctx, char *gen_sudoku)
+{
+    char best[SUDOKU_LEN];
+    enum SudokuGrade best_grade = SUDOKU_GRADE_NONE;
+
+    for (int i = 0; i < SUDOKU_GRADE_TRIES && best_grade != ctx->difficulty; i++) {
+        ctx->progress_state.removed = 0;
+        if (!fill_grid(ctx, gen_sudoku))
+            return;
+
+        begin_phase(ctx, SUDOKU_PHASE_REMOVE);
+        enum SudokuGrade grade = remove_nums_graded(ctx, gen_sudoku);
+        end_phase(ctx);
+        if (ctx->cancelled)
+            return;
+
+        if (grade > best_grade) {
+            best_grade = grade;
+            memcpy(best, gen_sudoku, SUDOKU_LEN);
         }
     }
 
-    // Solve the remaining blocks
-    solve(gen_sudoku, opts->gen_visual);
+    if (memcmp(best, gen_sudoku, SUDOKU_LEN) != 0) {
+        memcpy(gen_sudoku, best, SUDOKU_LEN);
+        report_step(ctx, gen_sudoku);
+    }
+}
+
+// Generate a random sudoku
+// This function fills out a grid with fill_grid() and then calls remove_nums()
+// to remove some numbers to create a complete puzzle. Returns false if it was
+// cancelled, leaving 'gen_sudoku' incomplete.
+// With a time budget, clues are removed until it is used up and the puzzle
+// with the fewest clues so far is returned. Filling the grid is not bounded
+// by the budget, it takes a fraction of a millisecond.
+// With a difficulty, grids are filled until clues can be removed down to the
+// grade asked for (generate_graded()). Minimal puzzles are made by
+// remove_nums_minimal().
+bool sudoku_generate(struct SudokuCtx *ctx, char *gen_sudoku)
+{
+    PROBE2(libsudoku, generate__start, ctx->attempts, ctx->budget_ns);
+
+    long long start = now_ns();
+    ctx->progress_state.removed = 0;
+
+    if (ctx->difficulty != SUDOKU_GRADE_NONE) {
+        generate_graded(ctx, gen_sudoku);
+        PROBE2(libsudoku, generate__end, gen_sudoku, ctx->cancelled);
+        return !ctx->cancelled;
+    }
+
+    if (!fill_grid(ctx, gen_sudoku)) {
+        PROBE2(libsudoku, generate__end, gen_sudoku, true);
+        return false;
+    }
+
     // Remove numbers but maintain unique solution
-    remove_nums(gen_sudoku, opts);
+    begin_phase(ctx, SUDOKU_PHASE_REMOVE);
+    if (ctx->minimal) {
+        remove_nums_minimal(ctx, gen_sudoku);
+    } else if (ctx->budget_ns > 0) {
+        ctx->deadline = start + ctx->budget_ns;
+        remove_nums_until_deadline(ctx, gen_sudoku);
+        ctx->deadline = 0;
+    } else if (ctx->speculate > 1) {
+        remove_nums_speculative(ctx, gen_sudoku);
+    } else {
+        remove_nums(ctx, gen_sudoku);
+    }
+    end_phase(ctx);
+
+    PROBE2(libsudoku, generate__end, gen_sudoku, ctx->cancelled);
+    return !ctx->cancelled;
+}
+
+// All cells in random order
+static void shuffle_cells(struct SudokuCtx *ctx, int *order)
+{
+    for (int i = 0; i < SUDOKU_LEN; i++)
+        order[i] = i;
+    for (int i = SUDOKU_LEN - 1; i > 0; i--) {
+        int j = random_below(ctx, i + 1);
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+}
+
+// Remove the clues in random order until the deadline passes, skipping those
+// whose removal makes the solution ambiguous. Removing further clues never
+// makes such a clue removable again, so once every clue has been tried the
+// puzzle is minimal and the search ends early.
+static void remove_nums_until_deadline(struct SudokuCtx *ctx, char *gen_sudoku)
+{
+    int order[SUDOKU_LEN];
+    shuffle_cells(ctx, order);
+
+    for (int i = 0; i < SUDOKU_LEN && now_ns() < ctx->deadline; i++) {
+        int cell = order[i];
+
+        char sudoku_cpy[SUDOKU_LEN];
+        memcpy(sudoku_cpy, gen_sudoku, SUDOKU_LEN);
+        sudoku_cpy[cell] = '0';
+
+        // Always hooked: the deadline is checked inside the search
+        int count = 0;
+        STAT(ctx, solution_counts++);
+        count_solutions(ctx, sudoku_cpy, &count, true);
+        // The count of an abandoned search means nothing, keep the clue
+        if (stopped(ctx)) {
+            PROBE3(libsudoku, remove__attempt, cell, -1, false);
+            return;
+        }
+
+        PROBE3(libsudoku, remove__attempt, cell, count, count == 1);
+        if (count == 1) {
+            gen_sudoku[cell] = '0';
+            ctx->progress_state.removed++;
+            STAT(ctx, removals_accepted++);
+            report_step(ctx, gen_sudoku);
+        } else {
+            STAT(ctx, removals_rejected++);
+        }
+    }
+}
+
+// Like remove_nums(), but draw ctx->speculate clues at once and count the
+// solutions without each of them against the same grid at the same time.
+// The results are then taken in the order the clues were drawn: clues before
+// the first removable one burn an attempt as usual, that one is removed.
+// Clues after it that failed fail on the new grid as well, removing a clue
+// never makes the solution unique again. Those that succeeded are tried again
+// against the new grid in the next round. This only depends on the order of
+// the clues, so the result is the same for any number of threads.
+static void remove_nums_speculative(struct SudokuCtx *ctx, char *gen_sudoku)
+{
+    bool hooks = has_hooks(ctx);
+    int local_attempts = ctx->attempts;
+
+    int cells[SUDOKU_SPECULATE_MAX];
+    int cells_len = 0;
+    char grids[SUDOKU_SPECULATE_MAX][SUDOKU_LEN];
+    int counts[SUDOKU_SPECULATE_MAX];
+
+    while (local_attempts > 0) {
+        int clues = 0;
+        for (int i = 0; i < SUDOKU_LEN; i++)
+            clues += gen_sudoku[i] != '0';
 
-    if (opts->gen_visual)
-        curs_set(1);
+        // Top up the clues carried over from the last round with new ones
+        while (cells_len < ctx->speculate && cells_len < clues) {
+            int cell = random_below(ctx, SUDOKU_LEN);
+            bool taken = gen_sudoku[cell] == '0';
+            for (int i = 0; i < cells_len && !taken; i++)
+                taken = cells[i] == cell;
+            if (!taken)
+                cells[cells_len++] = cell;
+        }
+
+        for (int i = 0; i < cells_len; i++) {
+            memcpy(grids[i], gen_sudoku, SUDOKU_LEN);
+            grids[i][cells[i]] = '0';
+        }
+        STAT(ctx, solution_counts += cells_len);
+        count_each(ctx, grids, cells_len, counts, hooks);
+        // The counts of a cancelled search mean nothing
+        if (hooks && stopped(ctx))
+            return;
+
+        bool removed = false;
+        int carried = 0;
+        for (int i = 0; i < cells_len && local_attempts > 0; i++) {
+            int cell = cells[i];
+            if (counts[i] == 1 && removed) {
+                cells[carried++] = cell;
+                continue;
+            }
+
+            PROBE3(libsudoku, remove__attempt, cell, counts[i], counts[i] == 1);
+            if (counts[i] == 1) {
+                gen_sudoku[cell] = '0';
+                removed = true;
+                ctx->progress_state.removed++;
+                STAT(ctx, removals_accepted++);
+                report_step(ctx, gen_sudoku);
+            } else {
+                STAT(ctx, removals_rejected++);
+                local_attempts--;
+            }
+        }
+        cells_len = carried;
+    }
 }
 
 // Try and remove numbers until the solution is not unique
-void remove_nums(char *gen_sudoku, const struct TSOpts *opts)
+static void remove_nums(struct SudokuCtx *ctx, char *gen_sudoku)
 {
-    int local_attempts = opts->attempts;
-    // Run down the attempts defined with '-n'
+    bool hooks = has_hooks(ctx);
+    int local_attempts = ctx->attempts;
+    // Run down the attempts
     while (local_attempts > 0) {
         // Get non-empty cell
         int cell = -1;
         while (cell < 0) {
-            cell = rand() % SUDOKU_LEN;
+            cell = random_below(ctx, SUDOKU_LEN);
             if (gen_sudoku[cell] == '0')
                 cell = -1;
         }
@@ -99,151 +728,1635 @@ void remove_nums(char *gen_sudoku, const struct TSOpts *opts)
 
         sudoku_cpy[cell] = '0';
         int count = 0;
-        solve_count(sudoku_cpy, &count);
+        STAT(ctx, solution_counts++);
+        count_solutions(ctx, sudoku_cpy, &count, hooks);
+        // The count of a cancelled search means nothing
+        if (hooks && stopped(ctx)) {
+            PROBE3(libsudoku, remove__attempt, cell, -1, false);
+            return;
+        }
+
+        PROBE3(libsudoku, remove__attempt, cell, count, count == 1);
 
         // If unique, apply to real sudoku
         if (count == 1) {
             gen_sudoku[cell] = '0';
-            if (opts->gen_visual)
-                generate_visually(gen_sudoku);
+            ctx->progress_state.removed++;
+            STAT(ctx, removals_accepted++);
+            report_step(ctx, gen_sudoku);
         }
         // Else, burn an attempt
         else {
+            STAT(ctx, removals_rejected++);
             local_attempts--;
         }
     }
 }
 
-// Solve a sudoku (used in generating)
-bool solve(char *sudoku_to_solve, bool visual)
+// Remove the clues in random order, keeping those whose removal makes the
+// puzzle harder than ctx->difficulty or its solution ambiguous, and return the
+// grade of the result. Each removal is graded again, giving up as soon as it
+// takes more than the target, so an overshoot costs little and is simply taken
+// back. Up to SUDOKU_GRADE_HARD the grader fills in the whole grid by logic,
+// which proves the solution unique: solutions are only counted for fiendish
+// puzzles.
+static enum SudokuGrade remove_nums_graded(struct SudokuCtx *ctx, char *gen_sudoku)
 {
-    // Draw the process of filling out the sudoku visually on the screen if that
-    // option is set via '-v'
-    if (visual)
-        generate_visually(sudoku_to_solve);
+    bool hooks = has_hooks(ctx);
+    enum SudokuGrade grade = SUDOKU_GRADE_EASY;
 
-    // If sudoku is valid, return
-    if (check_validity(sudoku_to_solve))
-        return true;
+    int order[SUDOKU_LEN];
+    shuffle_cells(ctx, order);
 
     for (int i = 0; i < SUDOKU_LEN; i++) {
-        if (sudoku_to_solve[i] == '0') {
-            // Try to assign a value to the cell at i
-            for (int j = '1'; j <= '9'; j++) {
-                bool used = false;
-                for (int k = 0; k < LINE_LEN && !used; k++) {
-                    // Check if the value is valid
-                    if (COLUMN(sudoku_to_solve, i, k) == j ||
-                        ROW(sudoku_to_solve, i, k) == j ||
-                        BLOCK(sudoku_to_solve, i, k) == j)
-                    {
-                        used = true;
-                    }
-                }
-                if (!used) {
-                    sudoku_to_solve[i] = j;
-                    // Check the whole path
-                    if (solve(sudoku_to_solve, visual)) {
-                        return true;
-                    }
+        int cell = order[i];
 
-                    // Otherwise, go back to 0
-                    sudoku_to_solve[i] = '0';
-                }
+        char sudoku_cpy[SUDOKU_LEN];
+        memcpy(sudoku_cpy, gen_sudoku, SUDOKU_LEN);
+        sudoku_cpy[cell] = '0';
+
+        // The count starts from what logic deduced instead of the bare clues
+        char deduced[SUDOKU_LEN];
+        enum SudokuGrade removed_grade = grade_up_to(ctx->constraints, sudoku_cpy, ctx->difficulty, deduced);
+        bool accepted = removed_grade <= ctx->difficulty;
+
+        if (accepted && removed_grade == SUDOKU_GRADE_FIENDISH) {
+            int count = 0;
+            STAT(ctx, solution_counts++);
+            count_solutions(ctx, deduced, &count, hooks);
+            // The count of a cancelled search means nothing
+            if (hooks && stopped(ctx)) {
+                PROBE3(libsudoku, remove__attempt, cell, -1, false);
+                return grade;
             }
+            PROBE3(libsudoku, remove__attempt, cell, count, count == 1);
+            accepted = count == 1;
+        }
+        PROBE3(libsudoku, grade__attempt, cell, removed_grade, accepted);
 
-            break;
+        if (accepted) {
+            gen_sudoku[cell] = '0';
+            grade = removed_grade;
+            ctx->progress_state.removed++;
+            STAT(ctx, removals_accepted++);
+            report_step(ctx, gen_sudoku);
+        } else {
+            STAT(ctx, removals_rejected++);
         }
     }
-    return false;
+
+    return grade;
 }
 
-// Count the solutions to a puzzle
-// Go through the puzzle recursively and increase count everytime you find a
-// solution
-void solve_count(char *sudoku_to_solve, int *count)
+static void cell_set_add(struct CellSet *set, int cell)
 {
-    // Function only needs to check if there is more than one unique
-    // solution, so return if there is
-    if (*count > 1)
-        return;
+    set->bits[cell / 64] |= 1ULL << (cell % 64);
+}
+
+static void cell_set_remove(struct CellSet *set, int cell)
+{
+    set->bits[cell / 64] &= ~(1ULL << (cell % 64));
+}
+
+// Whether 'cell' is the only one of 'clues' left in 'set'
+static bool last_clue_in(const struct CellSet *set, const struct CellSet *clues, int cell)
+{
+    struct CellSet only = { { 0, 0 } };
+    cell_set_add(&only, cell);
+
+    return (set->bits[0] & clues->bits[0]) == only.bits[0] &&
+           (set->bits[1] & clues->bits[1]) == only.bits[1];
+}
+
+// Remove every clue that can go, trying each once in random order. Removing
+// further clues never makes a clue removable again, so the result is minimal.
+// The checks share work in two ways: the unavoidable sets of the grid are found
+// once, and a clue that is the last one left in such a set is kept without a
+// search. Otherwise the solution is already known, so instead of counting up to
+// two solutions the search only looks for one with another digit in the cell.
+static void remove_nums_minimal(struct SudokuCtx *ctx, char *gen_sudoku)
+{
+    bool hooks = has_hooks(ctx);
+
+    struct CellSet sets[MINIMAL_SETS_MAX];
+    int sets_len = find_unavoidable_sets(ctx->constraints, gen_sudoku, sets, MINIMAL_SETS_MAX);
+
+    struct CellSet clues = { { 0, 0 } };
+    for (int i = 0; i < SUDOKU_LEN; i++)
+        cell_set_add(&clues, i);
+
+    int order[SUDOKU_LEN];
+    shuffle_cells(ctx, order);
 
-    // find empty cell
     for (int i = 0; i < SUDOKU_LEN; i++) {
-        if (sudoku_to_solve[i] == '0') {
-            // Try to assign a value to the cell at i
-            for (int j = '1'; j <= '9'; j++) {
-                bool used = false;
-                for (int k = 0; k < LINE_LEN && !used; k++) {
-                    // Check if the value is valid
-                    if (COLUMN(sudoku_to_solve, i, k) == j ||
-                        ROW(sudoku_to_solve, i, k) == j ||
-                        BLOCK(sudoku_to_solve, i, k) == j)
-                    {
-                        used = true;
-                    }
-                }
-                if (!used) {
-                    sudoku_to_solve[i] = j;
-                    // If assigning this value solved the grid, increase the
-                    // count
-                    if (check_validity(sudoku_to_solve)) {
-                        *count += 1;
-                        sudoku_to_solve[i] = '0';
-                        break;
-                    }
-                    // If not solved recursively call
-                    else {
-                        // Check the whole path
-                        solve_count(sudoku_to_solve, count);
-                    }
+        int cell = order[i];
 
-                    // Otherwise, go back to 0
-                    sudoku_to_solve[i] = '0';
-                }
+        bool kept = false;
+        for (int j = 0; j < sets_len && !kept; j++)
+            kept = last_clue_in(&sets[j], &clues, cell);
+
+        if (!kept) {
+            char sudoku_cpy[SUDOKU_LEN];
+            memcpy(sudoku_cpy, gen_sudoku, SUDOKU_LEN);
+            sudoku_cpy[cell] = '0';
+
+            STAT(ctx, solution_counts++);
+            kept = has_other_solution(ctx, sudoku_cpy, cell, CHNUM(gen_sudoku[cell]), hooks);
+            // The result of a cancelled search means nothing
+            if (hooks && stopped(ctx)) {
+                PROBE3(libsudoku, remove__attempt, cell, -1, false);
+                return;
             }
-            break;
+        }
+
+        PROBE3(libsudoku, remove__attempt, cell, kept ? 2 : 1, !kept);
+        if (kept) {
+            STAT(ctx, removals_rejected++);
+        } else {
+            gen_sudoku[cell] = '0';
+            cell_set_remove(&clues, cell);
+            ctx->progress_state.removed++;
+            STAT(ctx, removals_accepted++);
+            report_step(ctx, gen_sudoku);
         }
     }
 }
 
-// Check for errors in the solved sudoku
-bool check_validity(const char *combined_solution)
+// The digits of the peers of 'cell' as bits, bit 0 for empty cells
+static ALWAYS_INLINE unsigned peer_digits(const struct Constraints *rules, const char *sudoku, int cell)
 {
-    /* Check first if it's possible that the solution is correct
-     * by checking if the values in it add up to nine times the sum
-     * of the nine digits (405) */
-    int sum = 0;
-    for (int i = 0; i < SUDOKU_LEN; i++) {
-        sum += CHNUM(combined_solution[i]);
+    const unsigned char *peers = rules->peers[cell];
+    unsigned used = 0;
+    for (int k = 0; k < rules->peers_len[cell]; k++)
+        used |= 1u << CHNUM(sudoku[peers[k]]);
+    return used;
+}
+
+static void *pool_thread(void *arg);
+static bool pool_thread_progress(const struct SudokuProgress *progress, void *user);
+
+static struct CountPool *pool_new(int len)
+{
+    struct CountPool *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->len = len;
+    pool->tasks_cap = (size_t)len * POOL_TASKS_PER_THREAD * LINE_LEN;
+    pool->threads = calloc(len, sizeof(*pool->threads));
+    pool->workers = calloc(len, sizeof(*pool->workers));
+    pool->tasks = malloc(pool->tasks_cap * SUDOKU_LEN);
+    pool->split = malloc(pool->tasks_cap * SUDOKU_LEN);
+    if (pool->threads == NULL || pool->workers == NULL || pool->tasks == NULL || pool->split == NULL) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool->tasks);
+        free(pool->split);
+        free(pool);
+        return NULL;
     }
-    if (sum != SOLUTION_SUM) {
-        return false;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (int i = 0; i < len; i++) {
+        pool->workers[i].threads = 1;
+        pool->workers[i].pool = pool;
+        pool->workers[i].abandon = &pool->stop;
+        pool->workers[i].progress = pool_thread_progress;
+        pool->workers[i].progress_user = pool;
+        pool->workers[i].constraints = &variants[SUDOKU_VARIANT_STANDARD];
+
+        if (pthread_create(&pool->threads[i], NULL, pool_thread, &pool->workers[i]) != 0) {
+            // Stop the threads that did start
+            pool->len = i;
+            pool_free(pool);
+            return NULL;
+        }
     }
 
+    return pool;
+}
 
-    // Go through all nine columns, rows and blocks and check for
-    // duplicates
-    for (int i = 0; i < LINE_LEN; i++) {
-        bool appeared[3][LINE_LEN + 1] = {false};
+static void pool_free(struct CountPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
 
-        for (int j = 0; j < LINE_LEN; j++) {
-            int cur_comp[3];
+    for (int i = 0; i < pool->len; i++)
+        pthread_join(pool->threads[i], NULL);
 
-            cur_comp[0] = CHNUM(COLUMN(combined_solution, i, j));
-            cur_comp[1] = CHNUM(ROW(combined_solution, i * LINE_LEN, j));
-            // evaluates to top-left cell of i'th block
-            cur_comp[2] = CHNUM(BLOCK(combined_solution, ((i / 3) * 3) + (((i % 3) * 3) * LINE_LEN), j));
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->tasks);
+    free(pool->split);
+    free(pool);
+}
+
+// Search the tasks of the current round until they run out or two solutions
+// have been found
+static void pool_run_tasks(struct CountPool *pool, struct SudokuCtx *worker)
+{
+    size_t task;
+    while (!atomic_load_explicit(&pool->stop, memory_order_relaxed) &&
+           (task = atomic_fetch_add(&pool->next_task, 1)) < pool->tasks_len) {
+        char grid[SUDOKU_LEN];
+        memcpy(grid, pool->tasks[task], SUDOKU_LEN);
+
+        worker->progress_state.nodes = 0;
+        int count = search_grid(worker, grid, 2, GUESS_FEWEST, pool->report);
+
+        // What pool_thread_progress() has not published yet
+        unsigned long long nodes = worker->progress_state.nodes;
+        if (pool->report)
+            nodes %= SUDOKU_PROGRESS_INTERVAL;
+        atomic_fetch_add_explicit(&pool->nodes, nodes, memory_order_relaxed);
+
+        if (pool->results != NULL)
+            pool->results[task] = count;
+        else if (count > 0 && atomic_fetch_add(&pool->found, count) + count > 1)
+            atomic_store(&pool->stop, true);
+    }
+}
+
+// Progress callback of the pool threads, called every SUDOKU_PROGRESS_INTERVAL
+// nodes while the caller shows progress
+static bool pool_thread_progress(const struct SudokuProgress *progress, void *user)
+{
+    struct CountPool *pool = user;
+    (void)progress;
+
+    atomic_fetch_add_explicit(&pool->nodes, SUDOKU_PROGRESS_INTERVAL, memory_order_relaxed);
+    return true;
+}
+
+static void *pool_thread(void *arg)
+{
+    struct SudokuCtx *worker = arg;
+    struct CountPool *pool = worker->pool;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->round == seen && !pool->quit)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->quit)
+            break;
+        seen = pool->round;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool_run_tasks(pool, worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->idle);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+
+// Fill in the first empty cells of 'sudoku' in every possible way until there
+// are enough partial grids to keep all threads busy. Grids that get completed
+// on the way are solutions and counted instead, their number is returned.
+static int pool_split(const struct SudokuCtx *ctx, struct CountPool *pool, const char *sudoku)
+{
+    size_t target = (size_t)pool->len * POOL_TASKS_PER_THREAD;
+    int found = 0;
+
+    memcpy(pool->tasks[0], sudoku, SUDOKU_LEN);
+    pool->tasks_len = 1;
+
+    for (int depth = 0; depth < POOL_SPLIT_DEPTH && pool->tasks_len > 0 &&
+                        pool->tasks_len < target && found < 2; depth++) {
+        size_t split_len = 0;
+
+        for (size_t t = 0; t < pool->tasks_len; t++) {
+            const char *grid = pool->tasks[t];
+            const char *empty = memchr(grid, '0', SUDOKU_LEN);
+            if (empty == NULL)
+                continue;
+            int cell = empty - grid;
+            unsigned used = peer_digits(ctx->constraints, grid, cell);
 
-            // Check if j'th number in column, row or block already appeared
-            for (int k = 0; k < 3; k++) {
-                if (appeared[k][cur_comp[k]])
-                    return false;
+            for (int digit = '1'; digit <= '9'; digit++) {
+                if (used & (1u << CHNUM(digit)))
+                    continue;
 
-                appeared[k][cur_comp[k]] = true;
+                char *child = pool->split[split_len];
+                memcpy(child, grid, SUDOKU_LEN);
+                child[cell] = digit;
+                if (sudoku_check_validity(ctx, child))
+                    found++;
+                else
+                    split_len++;
             }
         }
+
+        char (*swap)[SUDOKU_LEN] = pool->tasks;
+        pool->tasks = pool->split;
+        pool->split = swap;
+        pool->tasks_len = split_len;
     }
 
-    return true;
+    return found;
+}
+
+// Let the threads work through the tasks of the pool. If the caller has
+// callbacks, it reports the progress and watches for cancellation and the
+// deadline in the meantime.
+static void pool_run_round(struct SudokuCtx *ctx, struct CountPool *pool)
+{
+    atomic_store(&pool->next_task, 0);
+    atomic_store(&pool->nodes, 0);
+
+    bool hooks = has_hooks(ctx);
+    pool->report = ctx->progress != NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    // The threads follow the rules of the caller
+    for (int i = 0; i < pool->len; i++) {
+        pool->workers[i].variant = ctx->variant;
+        pool->workers[i].constraints = ctx->constraints;
+    }
+    pool->round++;
+    pool->running = pool->len;
+    pthread_cond_broadcast(&pool->wake);
+
+    unsigned long long nodes_before = ctx->progress_state.nodes;
+    while (pool->running > 0) {
+        if (!hooks) {
+            pthread_cond_wait(&pool->idle, &pool->lock);
+            continue;
+        }
+
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += POOL_POLL_NS;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&pool->idle, &pool->lock, &until);
+
+        ctx->progress_state.nodes = nodes_before + atomic_load(&pool->nodes);
+        if (ctx->progress != NULL && !ctx->progress(&ctx->progress_state, ctx->progress_user))
+            ctx->cancelled = true;
+        if (ctx->deadline != 0 && now_ns() >= ctx->deadline)
+            ctx->expired = true;
+        if (stopped(ctx))
+            atomic_store(&pool->stop, true);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    ctx->progress_state.nodes = nodes_before + atomic_load(&pool->nodes);
+#ifdef SUDOKU_STATS
+    // The threads are idle, their counters can be collected
+    for (int i = 0; i < pool->len; i++) {
+        struct SudokuStats *worker = &pool->workers[i].stats;
+        ctx->stats.nodes += worker->nodes;
+        ctx->stats.backtracks += worker->backtracks;
+        ctx->stats.validity_checks += worker->validity_checks;
+        if (worker->max_depth > ctx->stats.max_depth)
+            ctx->stats.max_depth = worker->max_depth;
+        memset(worker, 0, sizeof(*worker));
+    }
+#endif
+}
+
+// Count up to two solutions of 'sudoku' on the pool, all threads working on
+// parts of the same search
+static int pool_count(struct SudokuCtx *ctx, struct CountPool *pool, const char *sudoku)
+{
+    int found = pool_split(ctx, pool, sudoku);
+    if (found > 1 || pool->tasks_len == 0)
+        return found > 1 ? 2 : found;
+
+    atomic_store(&pool->found, found);
+    atomic_store(&pool->stop, false);
+    pool_run_round(ctx, pool);
+
+    found = atomic_load(&pool->found);
+    return found > 1 ? 2 : found;
+}
+
+// Count up to two solutions of each of 'len' grids on the pool, one grid per
+// task
+static void pool_count_each(struct SudokuCtx *ctx, struct CountPool *pool,
+                            char (*grids)[SUDOKU_LEN], int len, int *counts)
+{
+    memcpy(pool->tasks, grids, (size_t)len * SUDOKU_LEN);
+    pool->tasks_len = len;
+    pool->results = counts;
+
+    atomic_store(&pool->stop, false);
+    pool_run_round(ctx, pool);
+
+    pool->results = NULL;
+}
+
+// Start the pool of 'ctx' if it is to have one, NULL if it runs alone
+static struct CountPool *get_pool(struct SudokuCtx *ctx)
+{
+    if (ctx->threads > 1 && ctx->pool == NULL) {
+        ctx->pool = pool_new(ctx->threads);
+        // Without threads, count alone
+        if (ctx->pool == NULL)
+            ctx->threads = 1;
+    }
+
+    return ctx->pool;
+}
+
+// Count up to two solutions of each of 'len' grids, on the pool if there are
+// threads for it
+static void count_each(struct SudokuCtx *ctx, char (*grids)[SUDOKU_LEN], int len, int *counts, bool hooks)
+{
+    struct CountPool *pool = get_pool(ctx);
+    if (pool != NULL) {
+        pool_count_each(ctx, pool, grids, len, counts);
+        return;
+    }
+
+    for (int i = 0; i < len; i++) {
+        counts[i] = 0;
+        count_solutions(ctx, grids[i], &counts[i], hooks);
+        if (hooks && stopped(ctx))
+            return;
+    }
+}
+
+// Count the solutions of 'sudoku' up to two into 'count', on the pool if
+// there are threads for it. Every single step is only reported sequentially.
+static void count_solutions(struct SudokuCtx *ctx, char *sudoku, int *count, bool hooks)
+{
+    struct CountPool *pool = ctx->step == NULL ? get_pool(ctx) : NULL;
+    if (pool != NULL) {
+        *count = pool_count(ctx, pool, sudoku);
+        return;
+    }
+
+    *count = search_grid(ctx, sudoku, 2, GUESS_FEWEST, hooks);
+}
+
+// Solve a sudoku in place, returns false if it has no solution or the search
+// was cancelled (see sudoku_cancelled())
+bool sudoku_solve(struct SudokuCtx *ctx, char *sudoku_to_solve)
+{
+    begin_phase(ctx, SUDOKU_PHASE_SOLVE);
+    PROBE1(libsudoku, solve__start, sudoku_to_solve);
+
+    bool solved = search_grid(ctx, sudoku_to_solve, 1, GUESS_FIRST, has_hooks(ctx)) == 1;
+
+    end_phase(ctx);
+    PROBE2(libsudoku, solve__end, solved, ctx->progress_state.nodes);
+    return solved;
+}
+
+// Count the solutions of a puzzle, stopping at two (more than one), -1 if the
+// search was cancelled
+int sudoku_count_solutions(struct SudokuCtx *ctx, const char *sudoku_to_count)
+{
+    begin_phase(ctx, SUDOKU_PHASE_SOLVE);
+    PROBE1(libsudoku, count__start, sudoku_to_count);
+
+    STAT(ctx, validity_checks++);
+    if (sudoku_check_validity(ctx, sudoku_to_count)) {
+        end_phase(ctx);
+        PROBE2(libsudoku, count__end, 1, 0ULL);
+        return 1;
+    }
+
+    char sudoku_cpy[SUDOKU_LEN];
+    memcpy(sudoku_cpy, sudoku_to_count, SUDOKU_LEN);
+
+    int count = 0;
+    STAT(ctx, solution_counts++);
+    count_solutions(ctx, sudoku_cpy, &count, has_hooks(ctx));
+
+    end_phase(ctx);
+    if (ctx->cancelled)
+        count = -1;
+    else if (count > 1)
+        count = 2;
+
+    PROBE2(libsudoku, count__end, count, ctx->progress_state.nodes);
+    return count;
+}
+
+// Check for errors in the solved sudoku
+bool sudoku_check_validity(const struct SudokuCtx *ctx, const char *combined_solution)
+{
+    const struct Constraints *rules = ctx->constraints;
+
+    /* Check first if it's possible that the solution is correct
+     * by checking if the values in it add up to nine times the sum
+     * of the nine digits (405) */
+    int sum = 0;
+    for (int i = 0; i < SUDOKU_LEN; i++) {
+        sum += CHNUM(combined_solution[i]);
+    }
+    if (sum != SOLUTION_SUM) {
+        return false;
+    }
+
+    // Go through all units and check for duplicates
+    for (int u = 0; u < rules->units_len; u++) {
+        unsigned appeared = 0;
+
+        for (int j = 0; j < LINE_LEN; j++) {
+            unsigned digit = 1u << CHNUM(combined_solution[rules->units[u][j]]);
+            if (appeared & digit)
+                return false;
+
+            appeared |= digit;
+        }
+    }
+
+    // Peers outside the units are compared one by one
+    if (rules->loose) {
+        for (int i = 0; i < SUDOKU_LEN; i++) {
+            if (peer_digits(rules, combined_solution, i) & (1u << CHNUM(combined_solution[i])))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// Count the clues that clash with one of their peers (another clue in the
+// same column, row or block, or whatever else the variant forbids) and mark
+// them in 'conflicts' (may be NULL)
+int sudoku_find_conflicts(const struct SudokuCtx *ctx, const char *sudoku, bool *conflicts)
+{
+    int found = 0;
+
+    for (int i = 0; i < SUDOKU_LEN; i++) {
+        bool conflict = sudoku[i] != '0' &&
+                        (peer_digits(ctx->constraints, sudoku, i) & (1u << CHNUM(sudoku[i])));
+
+        if (conflict)
+            found++;
+        if (conflicts != NULL)
+            conflicts[i] = conflict;
+    }
+
+    return found;
+}
+
+// Read a puzzle from text: the digits 1-9 are clues, '0' and '.' are empty
+// cells, whitespace and the characters of drawn grids ('|', '-', '+') are
+// skipped. Returns the number of cells read, or -1 if the text contains any
+// other character or more than SUDOKU_LEN cells.
+int sudoku_parse(const char *text, size_t len, char *parsed)
+{
+    int cells = 0;
+
+    for (size_t i = 0; i < len && text[i] != '\0'; i++) {
+        char c = text[i];
+
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+            c == '|' || c == '-' || c == '+')
+            continue;
+
+        if (cells == SUDOKU_LEN)
+            return -1;
+
+        if (c >= '1' && c <= '9')
+            parsed[cells++] = c;
+        else if (c == '0' || c == '.')
+            parsed[cells++] = '0';
+        else
+            return -1;
+    }
+
+    return cells;
+}
+
+// A change to the state of a grading: what 'cell' held before it
+struct TrailEntry {
+    unsigned char cell;
+    char digit;
+    unsigned short cands;
+};
+
+// Every change places a digit or removes a candidate, so there are never more
+// than this many on the trail
+#define TRAIL_LEN (SUDOKU_LEN * (LINE_LEN + 1))
+
+// Candidates of the empty cells of a puzzle that is being graded or searched,
+// one bit per digit. Every change is kept on the trail, so a search can take
+// back a guess and all that followed from it with grade_undo().
+struct Grading {
+    const struct Constraints *rules;
+    char sudoku[SUDOKU_LEN];
+    unsigned short cands[SUDOKU_LEN];
+    int empty;
+    struct TrailEntry trail[TRAIL_LEN];
+    int trail_len;
+};
+
+#define GRADE_ALL ((1u << LINE_LEN) - 1)
+
+static void grade_push(struct Grading *g, int cell)
+{
+    g->trail[g->trail_len++] = (struct TrailEntry){ cell, g->sudoku[cell], g->cands[cell] };
+}
+
+// Take the digits of 'mask' from the candidates of 'cell'
+static void grade_remove(struct Grading *g, int cell, unsigned mask)
+{
+    if ((g->cands[cell] & mask) == 0)
+        return;
+    grade_push(g, cell);
+    g->cands[cell] &= ~mask;
+}
+
+static void grade_place(struct Grading *g, int cell, int digit)
+{
+    const struct Constraints *rules = g->rules;
+
+    grade_push(g, cell);
+    g->sudoku[cell] = '0' + digit;
+    g->cands[cell] = 0;
+    g->empty--;
+
+    for (int k = 0; k < rules->peers_len[cell]; k++)
+        grade_remove(g, rules->peers[cell][k], 1u << (digit - 1));
+}
+
+// Take back the changes since the trail was 'mark' long
+static void grade_undo(struct Grading *g, int mark)
+{
+    while (g->trail_len > mark) {
+        const struct TrailEntry *entry = &g->trail[--g->trail_len];
+        if (g->sudoku[entry->cell] != entry->digit)
+            g->empty++;
+        g->sudoku[entry->cell] = entry->digit;
+        g->cands[entry->cell] = entry->cands;
+    }
+}
+
+static bool in_unit(const struct Constraints *rules, int cell, int unit)
+{
+    return (rules->cell_unit_bits[cell] >> unit) & 1;
+}
+
+static int count_digits(unsigned mask)
+{
+#ifdef __GNUC__
+    return __builtin_popcount(mask);
+#else
+    int count = 0;
+    for (; mask != 0; mask &= mask - 1)
+        count++;
+    return count;
+#endif
+}
+
+static int lowest_digit(unsigned mask)
+{
+    int digit = 1;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        digit++;
+    }
+    return digit;
+}
+
+// Place naked singles (a cell with one candidate) among 'cells' and hidden
+// singles (a digit with one place left in a unit) in 'units', one bit per
+// unit, until there are none. False if the puzzle turns out to have no
+// solution.
+static bool grade_singles_in(struct Grading *g, const unsigned char *cells, int len, unsigned units)
+{
+    const struct Constraints *rules = g->rules;
+    bool placed = true;
+
+    while (placed && g->empty > 0) {
+        placed = false;
+
+        for (int i = 0; i < len; i++) {
+            int cell = cells[i];
+            unsigned cands = g->cands[cell];
+            if (g->sudoku[cell] != '0')
+                continue;
+            if (cands == 0)
+                return false;
+            if ((cands & (cands - 1)) == 0) {
+                grade_place(g, cell, lowest_digit(cands));
+                placed = true;
+            }
+        }
+
+        for (int unit = 0; unit < rules->units_len; unit++) {
+            if (!((units >> unit) & 1))
+                continue;
+
+            // Digits seen once and more than once among the candidates, and
+            // digits already placed in the unit
+            unsigned once = 0, twice = 0, done = 0;
+            for (int i = 0; i < LINE_LEN; i++) {
+                int cell = rules->units[unit][i];
+                if (g->sudoku[cell] != '0')
+                    done |= 1u << (CHNUM(g->sudoku[cell]) - 1);
+                twice |= once & g->cands[cell];
+                once |= g->cands[cell];
+            }
+            if ((once | done) != GRADE_ALL)
+                return false;
+
+            unsigned hidden = once & ~twice;
+            for (int i = 0; i < LINE_LEN && hidden != 0; i++) {
+                int cell = rules->units[unit][i];
+                unsigned single = g->cands[cell] & hidden;
+                if (single != 0) {
+                    // Two hidden singles in one cell leave no solution
+                    if ((single & (single - 1)) != 0)
+                        return false;
+                    hidden &= ~single;
+                    grade_place(g, cell, lowest_digit(single));
+                    placed = true;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// The same for the whole grid
+static bool grade_singles(struct Grading *g)
+{
+    static const unsigned char cells[SUDOKU_LEN] = { STD_CELLS(STD_CELL) };
+    return grade_singles_in(g, cells, SUDOKU_LEN, ~0u);
+}
+
+// Remove candidates by locked candidates: a digit confined to where a block
+// and a line cross is no candidate elsewhere on the line (pointing), and the
+// other way round (claiming), likewise for any two units sharing cells. False
+// if nothing was removed.
+static bool grade_locked(struct Grading *g)
+{
+    const struct Constraints *rules = g->rules;
+    bool removed = false;
+
+    for (int o = 0; o < rules->overlaps_len; o++) {
+        int block = rules->overlaps[o][0];
+        int line = rules->overlaps[o][1];
+
+        // Candidates where the units cross, and in the rest of each
+        unsigned both = 0, block_only = 0, line_only = 0;
+        for (int i = 0; i < LINE_LEN; i++) {
+            int block_cell = rules->units[block][i];
+            if (in_unit(rules, block_cell, line))
+                both |= g->cands[block_cell];
+            else
+                block_only |= g->cands[block_cell];
+
+            int line_cell = rules->units[line][i];
+            if (!in_unit(rules, line_cell, block))
+                line_only |= g->cands[line_cell];
+        }
+
+        unsigned pointing = both & ~block_only & line_only;
+        unsigned claiming = both & ~line_only & block_only;
+        for (int i = 0; i < LINE_LEN; i++) {
+            int line_cell = rules->units[line][i];
+            if (pointing != 0 && !in_unit(rules, line_cell, block))
+                grade_remove(g, line_cell, pointing);
+            int block_cell = rules->units[block][i];
+            if (claiming != 0 && !in_unit(rules, block_cell, line))
+                grade_remove(g, block_cell, claiming);
+        }
+        removed |= pointing != 0 || claiming != 0;
+    }
+
+    return removed;
+}
+
+// Remove candidates by naked pairs: two cells of a unit with the same two
+// candidates take them from the rest of the unit. False if nothing was removed.
+static bool grade_pairs(struct Grading *g)
+{
+    const struct Constraints *rules = g->rules;
+    bool removed = false;
+
+    for (int unit = 0; unit < rules->units_len; unit++) {
+        for (int i = 0; i < LINE_LEN; i++) {
+            unsigned pair = g->cands[rules->units[unit][i]];
+            if (count_digits(pair) != 2)
+                continue;
+
+            for (int j = i + 1; j < LINE_LEN; j++) {
+                if (g->cands[rules->units[unit][j]] != pair)
+                    continue;
+
+                for (int k = 0; k < LINE_LEN; k++) {
+                    int cell = rules->units[unit][k];
+                    if (k != i && k != j && (g->cands[cell] & pair) != 0) {
+                        grade_remove(g, cell, pair);
+                        removed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    return removed;
+}
+
+// Remove candidates by locked candidates or naked pairs, false if nothing was
+// removed
+static bool grade_eliminate(struct Grading *g)
+{
+    bool removed = grade_locked(g);
+    removed |= grade_pairs(g);
+    return removed;
+}
+
+// Place singles and remove locked candidates until neither gets any further,
+// which is all a search does between its guesses. False if the puzzle turns
+// out to have no solution.
+static bool grade_propagate(struct Grading *g)
+{
+    while (grade_singles(g)) {
+        if (g->empty == 0 || !grade_locked(g))
+            return true;
+    }
+    return false;
+}
+
+// Start grading 'sudoku', false if two of its clues clash
+static bool grading_init(struct Grading *g, const struct Constraints *rules, const char *sudoku)
+{
+    bool clash = false;
+
+    g->rules = rules;
+    memset(g->sudoku, '0', SUDOKU_LEN);
+    g->empty = SUDOKU_LEN;
+    g->trail_len = 0;
+    for (int i = 0; i < SUDOKU_LEN; i++)
+        g->cands[i] = GRADE_ALL;
+    for (int i = 0; i < SUDOKU_LEN; i++) {
+        if (sudoku[i] != '0') {
+            clash |= !(g->cands[i] & (1u << (CHNUM(sudoku[i]) - 1)));
+            grade_place(g, i, CHNUM(sudoku[i]));
+        }
+    }
+
+    return !clash;
+}
+
+// Grade a puzzle, giving up as soon as it takes more than 'limit' (the result
+// is then the grade above it). A fiendish puzzle is written to 'deduced' (if
+// not NULL) with the digits logic could place, it has the same solutions.
+static enum SudokuGrade grade_up_to(const struct Constraints *rules, const char *sudoku,
+                                    enum SudokuGrade limit, char *deduced)
+{
+    struct Grading g;
+    grading_init(&g, rules, sudoku);
+
+    enum SudokuGrade grade = SUDOKU_GRADE_EASY;
+    while (grade_singles(&g) && g.empty > 0) {
+        if (limit < SUDOKU_GRADE_HARD)
+            return SUDOKU_GRADE_HARD;
+        if (!grade_eliminate(&g))
+            break;
+        grade = SUDOKU_GRADE_HARD;
+    }
+
+    // Logic got stuck or ran into a contradiction (then there is no solution
+    // to find by guessing either, but it takes guessing to tell)
+    if (g.empty > 0) {
+        if (deduced != NULL)
+            memcpy(deduced, g.sudoku, SUDOKU_LEN);
+        return SUDOKU_GRADE_FIENDISH;
+    }
+    return grade;
+}
+
+// The empty cell with the fewest candidates
+static int fewest_candidates(const struct Grading *g)
+{
+    int guess = -1;
+    int fewest = LINE_LEN + 1;
+    for (int cell = 0; cell < SUDOKU_LEN && fewest > 1; cell++) {
+        if (g->sudoku[cell] != '0')
+            continue;
+        int count = count_digits(g->cands[cell]);
+        if (count < fewest) {
+            guess = cell;
+            fewest = count;
+        }
+    }
+    return guess;
+}
+
+// Search for up to 'limit' solutions, propagating (see grade_propagate())
+// before every guess and undoing each guess through the trail. Once there are
+// 'limit' solutions the last one is left in 'g'. Only GUESS_FIRST reports its
+// steps: GUESS_FEWEST searches work on grids the caller is not showing.
+static ALWAYS_INLINE void search_body(struct SudokuCtx *ctx, struct Grading *g, int *found,
+                                      int limit, enum Guess guess, const bool hooks)
+{
+    // Another thread of the pool found enough
+    if (ctx->abandon != NULL && atomic_load_explicit(ctx->abandon, memory_order_relaxed))
+        return;
+
+    ctx->progress_state.nodes++;
+    if (hooks) {
+        if (guess == GUESS_FIRST)
+            report_step(ctx, g->sudoku);
+        if (!count_node(ctx))
+            return;
+    }
+    STAT(ctx, nodes++);
+
+    if (!grade_propagate(g))
+        return;
+    if (g->empty == 0) {
+        STAT(ctx, validity_checks++);
+        *found += 1;
+        return;
+    }
+
+    int cell;
+    if (guess == GUESS_FIRST)
+        cell = (char *)memchr(g->sudoku, '0', SUDOKU_LEN) - g->sudoku;
+    else
+        cell = fewest_candidates(g);
+    int mark = g->trail_len;
+    for (unsigned cands = g->cands[cell]; cands != 0; cands &= cands - 1) {
+        grade_place(g, cell, lowest_digit(cands));
+        if (hooks)
+            search_hooked(ctx, g, found, limit, guess);
+        else
+            search_plain(ctx, g, found, limit, guess);
+        if (*found >= limit)
+            return;
+
+        grade_undo(g, mark);
+        STAT(ctx, backtracks++);
+        if (hooks && stopped(ctx))
+            return;
+    }
+}
+
+static void search_plain(struct SudokuCtx *ctx, struct Grading *g, int *found, int limit, enum Guess guess)
+{
+    enter_search(ctx);
+    search_body(ctx, g, found, limit, guess, false);
+    leave_search(ctx);
+}
+
+static void search_hooked(struct SudokuCtx *ctx, struct Grading *g, int *found, int limit, enum Guess guess)
+{
+    enter_search(ctx);
+    search_body(ctx, g, found, limit, guess, true);
+    leave_search(ctx);
+}
+
+// Count the solutions of 'sudoku' up to 'limit' with search_body(). With a
+// limit of 1, the solution is written to 'sudoku'.
+static int search_grid(struct SudokuCtx *ctx, char *sudoku, int limit, enum Guess guess, bool hooks)
+{
+    struct Grading g;
+    int found = 0;
+
+    if (!grading_init(&g, ctx->constraints, sudoku))
+        return 0;
+    if (hooks)
+        search_hooked(ctx, &g, &found, limit, guess);
+    else
+        search_plain(ctx, &g, &found, limit, guess);
+
+    if (limit == 1 && found == 1)
+        memcpy(sudoku, g.sudoku, SUDOKU_LEN);
+    return found;
+}
+
+// Put the 'len' numbers of 'items' in random order
+static void shuffle_ints(struct SudokuCtx *ctx, int *items, int len)
+{
+    for (int i = len - 1; i > 0; i--) {
+        int j = random_below(ctx, i + 1);
+        int tmp = items[i];
+        items[i] = items[j];
+        items[j] = tmp;
+    }
+}
+
+// Fill in the empty cells of 'g' at random: the cell with the fewest
+// candidates first, with one of them drawn at random, backtracking when a cell
+// runs out of candidates. With 'singles', naked and hidden singles are placed
+// before every guess. Gives up once 'budget' nodes are used up or the search
+// is cancelled.
+static bool fill_search(struct SudokuCtx *ctx, struct Grading *g, int *budget, bool singles, bool hooks)
+{
+    if (g->empty == 0)
+        return true;
+    if (*budget == 0)
+        return false;
+    (*budget)--;
+
+    ctx->progress_state.nodes++;
+    STAT(ctx, nodes++);
+    if (hooks) {
+        report_step(ctx, g->sudoku);
+        if (!count_node(ctx))
+            return false;
+    }
+
+    if (singles && !grade_singles(g))
+        return false;
+    if (g->empty == 0)
+        return true;
+
+    int cell = fewest_candidates(g);
+    int mark = g->trail_len;
+    for (unsigned cands = g->cands[cell]; cands != 0;) {
+        unsigned pick = cands;
+        for (int skip = random_below(ctx, count_digits(cands)); skip > 0; skip--)
+            pick &= pick - 1;
+        pick &= -pick;
+
+        grade_place(g, cell, lowest_digit(pick));
+        enter_search(ctx);
+        bool filled = fill_search(ctx, g, budget, singles, hooks);
+        leave_search(ctx);
+        if (filled)
+            return true;
+
+        grade_undo(g, mark);
+        STAT(ctx, backtracks++);
+        if (*budget == 0 || (hooks && stopped(ctx)))
+            return false;
+        cands &= ~pick;
+    }
+    return false;
+}
+
+// Rows (or columns) of the standard grid in a random order that keeps it
+// valid: the bands in random order, the rows of each band in random order
+static void shuffle_lines(struct SudokuCtx *ctx, int *lines)
+{
+    int bands[3] = { 0, 1, 2 };
+    shuffle_ints(ctx, bands, 3);
+    for (int b = 0; b < 3; b++) {
+        int rows[3] = { 0, 1, 2 };
+        shuffle_ints(ctx, rows, 3);
+        for (int i = 0; i < 3; i++)
+            lines[b * 3 + i] = bands[b] * 3 + rows[i];
+    }
+}
+
+// Copy 'grid' to 'out' moved by a random symmetry of the standard grid: rows
+// and columns shuffled by shuffle_lines(), possibly transposed
+static void shuffle_standard(struct SudokuCtx *ctx, const char *grid, char *out)
+{
+    int rows[LINE_LEN], cols[LINE_LEN];
+    shuffle_lines(ctx, rows);
+    shuffle_lines(ctx, cols);
+    bool transpose = random_below(ctx, 2) == 1;
+
+    for (int r = 0; r < LINE_LEN; r++) {
+        for (int c = 0; c < LINE_LEN; c++) {
+            int from = transpose ? cols[c] * LINE_LEN + rows[r] : rows[r] * LINE_LEN + cols[c];
+            out[r * LINE_LEN + c] = grid[from];
+        }
+    }
+}
+
+// Fill a grid at random with fill_search(), starting over from the empty grid
+// whenever it takes more than FILL_RESTART_NODES nodes: a search that went
+// wrong early can take long to recover, a new one rarely does. Standard grids
+// are then moved by a random symmetry. False if it was cancelled.
+static bool fill_grid(struct SudokuCtx *ctx, char *gen_sudoku)
+{
+    struct Grading g;
+    bool hooks = has_hooks(ctx);
+    bool filled = false;
+
+    memset(gen_sudoku, '0', SUDOKU_LEN);
+    begin_phase(ctx, SUDOKU_PHASE_FILL);
+    grading_init(&g, ctx->constraints, gen_sudoku);
+
+    // Placing singles costs more than it saves in most grids, but not in those
+    // whose rules already led one search astray
+    for (bool singles = false; !filled && !(hooks && stopped(ctx)); singles = true) {
+        int budget = FILL_RESTART_NODES;
+        grade_undo(&g, 0);
+        filled = fill_search(ctx, &g, &budget, singles, hooks);
+    }
+
+    if (filled) {
+        if (ctx->variant == SUDOKU_VARIANT_STANDARD)
+            shuffle_standard(ctx, g.sudoku, gen_sudoku);
+        else
+            memcpy(gen_sudoku, g.sudoku, SUDOKU_LEN);
+        report_step(ctx, gen_sudoku);
+    }
+    end_phase(ctx);
+    return filled;
+}
+
+// Fill 'grid' with a random complete grid of the rules of 'ctx', see
+// fill_grid(). Every grid can come out, and grids that only differ in the
+// names of the digits are equally likely. For the standard rules so are grids
+// that differ by swapping bands, stacks, rows within a band or columns within
+// a stack, or by transposing. Returns false if it was cancelled.
+bool sudoku_fill(struct SudokuCtx *ctx, char *grid)
+{
+    return fill_grid(ctx, grid);
+}
+
+// Whether a puzzle has a solution with something else than 'digit' in 'cell'
+static bool has_other_solution(struct SudokuCtx *ctx, const char *sudoku, int cell, int digit, bool hooks)
+{
+    struct Grading g;
+    int found = 0;
+
+    grading_init(&g, ctx->constraints, sudoku);
+    g.cands[cell] &= ~(1u << (digit - 1));
+    if (hooks)
+        search_hooked(ctx, &g, &found, 1, GUESS_FEWEST);
+    else
+        search_plain(ctx, &g, &found, 1, GUESS_FEWEST);
+
+    return found > 0;
+}
+
+// A sub-problem of an exact count that is remembered: the empty cells of a
+// component with their candidates, and the number of ways to fill them in
+struct ExactEntry {
+    unsigned long long hash;
+    unsigned long long count;
+    unsigned char len;
+    unsigned char cells[EXACT_CACHE_CELLS];
+    unsigned short cands[EXACT_CACHE_CELLS];
+};
+
+// State of sudoku_count_exact()
+struct ExactCount {
+    struct Grading grading;
+    // EXACT_CACHE_LEN entries, or NULL to count without remembering
+    struct ExactEntry *cache;
+};
+
+static unsigned long long add_capped(unsigned long long a, unsigned long long b, unsigned long long limit)
+{
+    return b >= limit || a >= limit - b ? limit : a + b;
+}
+
+static unsigned long long mul_capped(unsigned long long a, unsigned long long b, unsigned long long limit)
+{
+    if (a == 0 || b == 0)
+        return 0;
+    return a > limit / b ? limit : a * b;
+}
+
+static unsigned long long component_hash(const struct Grading *g, const unsigned char *cells, int len)
+{
+    // FNV-1a over the cells and their candidates
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ cells[i]) * 0x100000001b3ULL;
+        hash = (hash ^ g->cands[cells[i]]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static bool entry_matches(const struct ExactEntry *entry, unsigned long long hash,
+                          const struct Grading *g, const unsigned char *cells, int len)
+{
+    if (entry->len != len || entry->hash != hash || memcmp(entry->cells, cells, len) != 0)
+        return false;
+    for (int i = 0; i < len; i++) {
+        if (entry->cands[i] != g->cands[cells[i]])
+            return false;
+    }
+    return true;
+}
+
+// Split the empty 'cells' (in ascending order) into components: cells are
+// joined if they are peers with a candidate in common. Nothing placed in one
+// component takes a candidate from another, so the count is the product of
+// theirs. The components go to 'order' one after the other, each in ascending
+// order, their lengths to 'lens'. Returns how many there are.
+static int split_components(const struct Grading *g, const unsigned char *cells, int len,
+                            unsigned char *order, unsigned char *lens)
+{
+    const struct Constraints *rules = g->rules;
+    // The component of each cell, -1 before it has one, -2 if not in 'cells'
+    signed char component[SUDOKU_LEN];
+    unsigned char stack[SUDOKU_LEN];
+    int components = 0;
+
+    memset(component, -2, sizeof(component));
+    for (int i = 0; i < len; i++)
+        component[cells[i]] = -1;
+
+    for (int i = 0; i < len; i++) {
+        if (component[cells[i]] != -1)
+            continue;
+
+        int stack_len = 0;
+        component[cells[i]] = components;
+        stack[stack_len++] = cells[i];
+        while (stack_len > 0) {
+            int cell = stack[--stack_len];
+            for (int k = 0; k < rules->peers_len[cell]; k++) {
+                int peer = rules->peers[cell][k];
+                if (component[peer] == -1 && (g->cands[cell] & g->cands[peer]) != 0) {
+                    component[peer] = components;
+                    stack[stack_len++] = peer;
+                }
+            }
+        }
+        components++;
+    }
+
+    int at = 0;
+    for (int c = 0; c < components; c++) {
+        lens[c] = 0;
+        for (int i = 0; i < len; i++) {
+            if (component[cells[i]] == c) {
+                order[at++] = cells[i];
+                lens[c]++;
+            }
+        }
+    }
+    return components;
+}
+
+// Count the ways to fill in 'cells' up to 'limit', the empty cells of one
+// component. Components are looked up in the cache first: different guesses
+// often leave the same component behind.
+static unsigned long long count_component(struct SudokuCtx *ctx, struct ExactCount *ec,
+                                          const unsigned char *cells, int len,
+                                          unsigned long long limit, bool hooks)
+{
+    struct Grading *g = &ec->grading;
+    struct ExactEntry *entry = NULL;
+    unsigned long long hash = 0;
+
+    if (ec->cache != NULL && len <= EXACT_CACHE_CELLS) {
+        hash = component_hash(g, cells, len);
+        entry = &ec->cache[hash % EXACT_CACHE_LEN];
+        if (entry_matches(entry, hash, g, cells, len))
+            return entry->count < limit ? entry->count : limit;
+    }
+
+    // The fewest candidates within the band of the first cell: filling in the
+    // grid band by band cuts it into components sooner and repeats them more
+    int guess = cells[0];
+    for (int i = 1; i < len && cells[i] / BAND_LEN == cells[0] / BAND_LEN; i++) {
+        if (count_digits(g->cands[cells[i]]) < count_digits(g->cands[guess]))
+            guess = cells[i];
+    }
+
+    unsigned long long total = 0;
+    int mark = g->trail_len;
+    for (unsigned cands = g->cands[guess]; cands != 0 && total < limit; cands &= cands - 1) {
+        grade_place(g, guess, lowest_digit(cands));
+
+        enter_search(ctx);
+        total = add_capped(total, count_split(ctx, ec, cells, len, limit - total, hooks), limit);
+        leave_search(ctx);
+
+        grade_undo(g, mark);
+        if (hooks && stopped(ctx))
+            return total;
+        STAT(ctx, backtracks++);
+    }
+
+    // A count cut off by the limit is no use to a search with a higher one
+    if (entry != NULL && total < limit) {
+        entry->hash = hash;
+        entry->count = total;
+        entry->len = len;
+        memcpy(entry->cells, cells, len);
+        for (int i = 0; i < len; i++)
+            entry->cands[i] = g->cands[cells[i]];
+    }
+    return total;
+}
+
+// Count the ways to fill in 'cells' up to 'limit': the empty cells of a part
+// of the grid whose candidates nothing outside of it can take. Propagates,
+// then multiplies the counts of the components that are left.
+static unsigned long long count_split(struct SudokuCtx *ctx, struct ExactCount *ec,
+                                      const unsigned char *cells, int len,
+                                      unsigned long long limit, bool hooks)
+{
+    struct Grading *g = &ec->grading;
+
+    ctx->progress_state.nodes++;
+    STAT(ctx, nodes++);
+    if (hooks && !count_node(ctx))
+        return 0;
+
+    // Locked candidates hardly ever pay for themselves here, and only the
+    // part of the grid 'cells' are in can change
+    unsigned units = 0;
+    for (int i = 0; i < len; i++)
+        units |= g->rules->cell_unit_bits[cells[i]];
+    if (!grade_singles_in(g, cells, len, units))
+        return 0;
+
+    unsigned char rest[SUDOKU_LEN];
+    int rest_len = 0;
+    for (int i = 0; i < len; i++) {
+        if (g->sudoku[cells[i]] == '0')
+            rest[rest_len++] = cells[i];
+    }
+    if (rest_len == 0) {
+        STAT(ctx, validity_checks++);
+        return 1;
+    }
+
+    unsigned char order[SUDOKU_LEN];
+    unsigned char lens[SUDOKU_LEN];
+    int components = split_components(g, rest, rest_len, order, lens);
+
+    unsigned long long product = 1;
+    for (int c = 0, at = 0; c < components; at += lens[c++]) {
+        // Enough solutions of this component to make up 'limit' with the others
+        unsigned long long needed = (limit - 1) / product + 1;
+        unsigned long long count = count_component(ctx, ec, order + at, lens[c], needed, hooks);
+        if (count == 0 || (hooks && stopped(ctx)))
+            return 0;
+        product = mul_capped(product, count, limit);
+    }
+    return product;
+}
+
+// Count the solutions of a puzzle exactly, stopping at 'limit' (0 for no
+// limit): a count of 'limit' means at least that many. The search fills in
+// naked and hidden singles, splits the empty cells into independent components
+// and remembers the counts of components it has seen, also for the next
+// counts of 'ctx'. False if it was cancelled.
+bool sudoku_count_exact(struct SudokuCtx *ctx, const char *sudoku, unsigned long long limit,
+                        struct SudokuCount *count)
+{
+    struct ExactCount ec;
+    unsigned long long solutions = 0;
+
+    begin_phase(ctx, SUDOKU_PHASE_SOLVE);
+    STAT(ctx, solution_counts++);
+    if (limit == 0)
+        limit = ULLONG_MAX;
+    // A component has the same count in every puzzle, only other rules make
+    // the cache useless. Without memory for it, count without it.
+    if (ctx->exact_cache == NULL)
+        ctx->exact_cache = calloc(EXACT_CACHE_LEN, sizeof(*ctx->exact_cache));
+    else if (ctx->exact_rules != ctx->constraints)
+        memset(ctx->exact_cache, 0, EXACT_CACHE_LEN * sizeof(*ctx->exact_cache));
+    ctx->exact_rules = ctx->constraints;
+    ec.cache = ctx->exact_cache;
+
+    if (grading_init(&ec.grading, ctx->constraints, sudoku)) {
+        unsigned char cells[SUDOKU_LEN];
+        int len = 0;
+        for (int i = 0; i < SUDOKU_LEN; i++) {
+            if (sudoku[i] == '0')
+                cells[len++] = i;
+        }
+        solutions = count_split(ctx, &ec, cells, len, limit, has_hooks(ctx));
+    }
+
+    count->solutions = solutions;
+    count->nodes = ctx->progress_state.nodes;
+    end_phase(ctx);
+    return !ctx->cancelled;
+}
+
+// The unavoidable sets of a solved grid made of two digits a and b: their cells
+// fall into cycles through the units (and the other peers of the variant), and
+// swapping a and b along one of them gives another solution. A puzzle with a
+// unique solution keeps a clue in each of them.
+static int find_unavoidable_sets(const struct Constraints *rules, const char *solution,
+                                 struct CellSet *sets, int cap)
+{
+    int len = 0;
+
+    for (char a = '1'; a <= '9'; a++) {
+        for (char b = a + 1; b <= '9'; b++) {
+            int cells[2 * LINE_LEN];
+            int group[2 * LINE_LEN];
+            int n = 0;
+            for (int cell = 0; cell < SUDOKU_LEN; cell++) {
+                if (solution[cell] == a || solution[cell] == b) {
+                    group[n] = n;
+                    cells[n++] = cell;
+                }
+            }
+
+            // Join the a and the b of every unit into one cycle
+            for (int i = 0; i < n; i++) {
+                for (int j = i + 1; j < n; j++) {
+                    bool shared = false;
+                    for (int k = 0; k < rules->peers_len[cells[i]] && !shared; k++)
+                        shared = rules->peers[cells[i]][k] == cells[j];
+                    if (!shared || group[i] == group[j])
+                        continue;
+
+                    int joined = group[j];
+                    for (int k = 0; k < n; k++) {
+                        if (group[k] == joined)
+                            group[k] = group[i];
+                    }
+                }
+            }
+
+            for (int i = 0; i < n && len < cap; i++) {
+                // Each cycle once, from its first cell
+                bool first = true;
+                for (int k = 0; k < i && first; k++)
+                    first = group[k] != group[i];
+                if (!first)
+                    continue;
+
+                sets[len] = (struct CellSet){ { 0, 0 } };
+                for (int k = i; k < n; k++) {
+                    if (group[k] == group[i])
+                        cell_set_add(&sets[len], cells[k]);
+                }
+                len++;
+            }
+        }
+    }
+
+    return len;
+}
+
+// Grade a puzzle by the hardest technique it takes to solve: singles alone,
+// locked candidates and naked pairs, or guessing. The puzzle is assumed to
+// have a unique solution (see sudoku_count_solutions()).
+enum SudokuGrade sudoku_grade(const struct SudokuCtx *ctx, const char *sudoku)
+{
+    return grade_up_to(ctx->constraints, sudoku, SUDOKU_GRADE_FIENDISH, NULL);
+}
+
+const char *sudoku_grade_name(enum SudokuGrade grade)
+{
+    switch (grade) {
+    case SUDOKU_GRADE_EASY:
+        return "easy";
+    case SUDOKU_GRADE_HARD:
+        return "hard";
+    case SUDOKU_GRADE_FIENDISH:
+        return "fiendish";
+    default:
+        return "none";
+    }
+}
+
+const char *sudoku_variant_name(enum SudokuVariant variant)
+{
+    switch (variant) {
+    case SUDOKU_VARIANT_X:
+        return "x";
+    case SUDOKU_VARIANT_JIGSAW:
+        return "jigsaw";
+    case SUDOKU_VARIANT_WINDOKU:
+        return "windoku";
+    case SUDOKU_VARIANT_ANTI_KING:
+        return "anti-king";
+    case SUDOKU_VARIANT_ANTI_KNIGHT:
+        return "anti-knight";
+    default:
+        return "standard";
+    }
+}
+
+// The region of 'cell' in 'variant', 0-8: its block, or its jigsaw region
+int sudoku_variant_region(enum SudokuVariant variant, int cell)
+{
+    if (variant == SUDOKU_VARIANT_JIGSAW)
+        return jigsaw_regions[cell] - '0';
+    return STD_BLOCK(cell);
+}
+
+// The units 'variant' has on top of the rows, columns and regions that 'cell'
+// is in, numbered from 0. Returns how many there are.
+static int extra_units(enum SudokuVariant variant, int cell, int *units)
+{
+    int row = cell / LINE_LEN;
+    int col = cell % LINE_LEN;
+    int len = 0;
+
+    if (variant == SUDOKU_VARIANT_X) {
+        if (row == col)
+            units[len++] = 0;
+        if (row + col == LINE_LEN - 1)
+            units[len++] = 1;
+    } else if (variant == SUDOKU_VARIANT_WINDOKU && row % 4 != 0 && col % 4 != 0) {
+        units[len++] = (row / 4) * 2 + col / 4;
+    }
+
+    return len;
+}
+
+// Whether 'cell' is in a unit that is neither a row, a column nor a region,
+// like the diagonals of SUDOKU_VARIANT_X
+bool sudoku_variant_marked(enum SudokuVariant variant, int cell)
+{
+    int units[CELL_UNITS_MAX];
+    return extra_units(variant, cell, units) > 0;
+}
+
+static void add_peer(struct Constraints *rules, int cell, int peer)
+{
+    for (int k = 0; k < rules->peers_len[cell]; k++) {
+        if (rules->peers[cell][k] == peer)
+            return;
+    }
+    if (peer != cell && rules->peers_len[cell] < PEERS_MAX)
+        rules->peers[cell][rules->peers_len[cell]++] = peer;
+}
+
+// Work out the tables of 'variant' from its units and its loose peers
+static void build_constraints(struct Constraints *rules, enum SudokuVariant variant)
+{
+    static const int king[][2] = { { -1, -1 }, { -1, 1 }, { 1, -1 }, { 1, 1 } };
+    static const int knight[][2] = { { -2, -1 }, { -2, 1 }, { -1, -2 }, { -1, 2 },
+                                     { 1, -2 }, { 1, 2 }, { 2, -1 }, { 2, 1 } };
+    int filled[UNITS_MAX] = { 0 };
+
+    // The rows and columns, then the regions, then the extra units
+    memset(rules, 0, sizeof(*rules));
+    memcpy(rules->units, variants[SUDOKU_VARIANT_STANDARD].units, 2 * LINE_LEN * LINE_LEN);
+    for (int u = 0; u < 2 * LINE_LEN; u++)
+        filled[u] = LINE_LEN;
+    rules->units_len = 3 * LINE_LEN;
+
+    for (int cell = 0; cell < SUDOKU_LEN; cell++) {
+        int units[CELL_UNITS_MAX];
+        int len = extra_units(variant, cell, units);
+        units[len++] = -1 - sudoku_variant_region(variant, cell);
+
+        for (int i = 0; i < len; i++) {
+            int unit = units[i] < 0 ? 2 * LINE_LEN - 1 - units[i] : 3 * LINE_LEN + units[i];
+            rules->units[unit][filled[unit]++] = cell;
+            if (unit >= rules->units_len)
+                rules->units_len = unit + 1;
+        }
+    }
+
+    for (int unit = 0; unit < rules->units_len; unit++) {
+        for (int i = 0; i < LINE_LEN; i++) {
+            int cell = rules->units[unit][i];
+            rules->cell_units[cell][rules->cell_units_len[cell]++] = unit;
+            rules->cell_unit_bits[cell] |= 1u << unit;
+        }
+    }
+
+    for (int cell = 0; cell < SUDOKU_LEN; cell++) {
+        for (int u = 0; u < rules->cell_units_len[cell]; u++) {
+            for (int i = 0; i < LINE_LEN; i++)
+                add_peer(rules, cell, rules->units[rules->cell_units[cell][u]][i]);
+        }
+        int unit_peers = rules->peers_len[cell];
+
+        const int (*moves)[2] = variant == SUDOKU_VARIANT_ANTI_KING ? king : knight;
+        int moves_len = variant == SUDOKU_VARIANT_ANTI_KING ? 4 :
+                        variant == SUDOKU_VARIANT_ANTI_KNIGHT ? 8 : 0;
+        for (int m = 0; m < moves_len; m++) {
+            int row = cell / LINE_LEN + moves[m][0];
+            int col = cell % LINE_LEN + moves[m][1];
+            if (row >= 0 && row < LINE_LEN && col >= 0 && col < LINE_LEN)
+                add_peer(rules, cell, row * LINE_LEN + col);
+        }
+        if (rules->peers_len[cell] > unit_peers)
+            rules->loose = true;
+    }
+
+    for (int a = 0; a < rules->units_len; a++) {
+        for (int b = a + 1; b < rules->units_len && rules->overlaps_len < OVERLAPS_MAX; b++) {
+            int shared = 0;
+            for (int i = 0; i < LINE_LEN; i++)
+                shared += in_unit(rules, rules->units[a][i], b);
+            if (shared < 2)
+                continue;
+
+            rules->overlaps[rules->overlaps_len][0] = a;
+            rules->overlaps[rules->overlaps_len][1] = b;
+            rules->overlaps_len++;
+        }
+    }
+}
+
+static void build_variants(void)
+{
+    for (int variant = SUDOKU_VARIANT_STANDARD + 1; variant < SUDOKU_VARIANT_COUNT; variant++)
+        build_constraints(&variants[variant], variant);
 }
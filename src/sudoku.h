@@ -16,18 +16,135 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
-#pragma once
+// libsudoku: generating, solving and checking Sudokus
+//
+// A grid is an array of SUDOKU_LEN characters, row by row, with '1'-'9' for
+// digits and '0' for empty cells. All state lives in a struct SudokuCtx, so
+// separate contexts can be used from separate threads. A context may also
+// count solutions on a pool of threads of its own (sudoku_ctx_set_threads()).
 
-#include "main.h"
+#pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#define LINE_LEN 9
+#define SUDOKU_LEN 81
+#define SOLUTION_SUM ((((LINE_LEN*LINE_LEN)+LINE_LEN)/2)*LINE_LEN) // sum of all numbers in a correct solution
+#define SUDOKU_ATTEMPTS_DEFAULT 5
+// Nodes of the search between two calls of the progress callback
+#define SUDOKU_PROGRESS_INTERVAL 4096
+// Nodes of the search between two looks at the clock when a time budget is set
+#define SUDOKU_DEADLINE_INTERVAL 256
+#define SUDOKU_THREADS_MAX 64
+#define SUDOKU_SPECULATE_MAX 64
+// Grids sudoku_generate() fills at most to hit a difficulty
+#define SUDOKU_GRADE_TRIES 64
 
-struct SudokuSpec {
-    char sudoku[SUDOKU_LEN];
-    char user[SUDOKU_LEN];
-    int notes[SUDOKU_LEN * LINE_LEN];
+struct SudokuCtx;
+
+enum SudokuPhase {
+    SUDOKU_PHASE_FILL,
+    SUDOKU_PHASE_REMOVE,
+    SUDOKU_PHASE_SOLVE,
+    SUDOKU_PHASE_COUNT,
 };
 
-void generate_sudoku(char *gen_sudoku, const struct TSOpts *opts);
-bool check_validity(const char *sudoku_to_check);
-bool solve(char *sudoku_to_solve, bool visual);
+// How hard a puzzle is for a human, by the techniques it takes to solve
+enum SudokuGrade {
+    SUDOKU_GRADE_NONE,
+    // Naked and hidden singles
+    SUDOKU_GRADE_EASY,
+    // Also locked candidates and naked pairs
+    SUDOKU_GRADE_HARD,
+    // These are not enough, it takes guessing
+    SUDOKU_GRADE_FIENDISH,
+    SUDOKU_GRADE_COUNT,
+};
+
+// Rules on top of the rows and columns. All of them keep a digit once in each
+// row, column and region: the blocks, or the fixed jigsaw regions.
+enum SudokuVariant {
+    SUDOKU_VARIANT_STANDARD,
+    // Also once on each of the two diagonals
+    SUDOKU_VARIANT_X,
+    // Irregular regions instead of blocks
+    SUDOKU_VARIANT_JIGSAW,
+    // Also once in each of four extra blocks, one cell in from the corners
+    SUDOKU_VARIANT_WINDOKU,
+    // No digit next to itself diagonally
+    SUDOKU_VARIANT_ANTI_KING,
+    // No digit a knight's move away from itself
+    SUDOKU_VARIANT_ANTI_KNIGHT,
+    SUDOKU_VARIANT_COUNT,
+};
+
+struct SudokuProgress {
+    enum SudokuPhase phase;
+    // Nodes of the search visited in this phase
+    unsigned long long nodes;
+    // Clues removed so far (SUDOKU_PHASE_REMOVE)
+    int removed;
+};
+
+// Counters of a context, only kept if libsudoku is built with SUDOKU_STATS
+struct SudokuStats {
+    // Nodes of all searches, digits taken back and the deepest recursion
+    unsigned long long nodes;
+    unsigned long long backtracks;
+    int max_depth;
+    // Solution counts (one per removal of a clue) and checks for a solved grid
+    unsigned long long solution_counts;
+    unsigned long long validity_checks;
+    // Removals of clues that kept the solution unique and those that did not
+    unsigned long long removals_accepted;
+    unsigned long long removals_rejected;
+    // Wall time spent in each phase
+    long long phase_ns[SUDOKU_PHASE_COUNT];
+};
+
+// Result of sudoku_count_exact()
+struct SudokuCount {
+    // Solutions of the puzzle, at most the limit of the count
+    unsigned long long solutions;
+    // Nodes of the search
+    unsigned long long nodes;
+};
+
+// Called with the grid after every step of the generator and the solver
+typedef void (*SudokuStepCallback)(const char *sudoku, void *user);
+// Called every SUDOKU_PROGRESS_INTERVAL nodes of a search, returning false
+// cancels the running operation
+typedef bool (*SudokuProgressCallback)(const struct SudokuProgress *progress, void *user);
+
+struct SudokuCtx *sudoku_ctx_new(void);
+void sudoku_ctx_free(struct SudokuCtx *ctx);
+void sudoku_ctx_seed(struct SudokuCtx *ctx, unsigned long long seed);
+void sudoku_ctx_set_attempts(struct SudokuCtx *ctx, int attempts);
+void sudoku_ctx_set_time_budget(struct SudokuCtx *ctx, unsigned budget_ms);
+void sudoku_ctx_set_threads(struct SudokuCtx *ctx, int threads);
+void sudoku_ctx_set_speculation(struct SudokuCtx *ctx, int candidates);
+void sudoku_ctx_set_difficulty(struct SudokuCtx *ctx, enum SudokuGrade grade);
+void sudoku_ctx_set_minimal(struct SudokuCtx *ctx, bool minimal);
+void sudoku_ctx_set_variant(struct SudokuCtx *ctx, enum SudokuVariant variant);
+void sudoku_ctx_set_step_callback(struct SudokuCtx *ctx, SudokuStepCallback callback, void *user);
+void sudoku_ctx_set_progress_callback(struct SudokuCtx *ctx, SudokuProgressCallback callback, void *user);
+
+bool sudoku_cancelled(const struct SudokuCtx *ctx);
+bool sudoku_ctx_get_stats(const struct SudokuCtx *ctx, struct SudokuStats *stats);
+void sudoku_ctx_reset_stats(struct SudokuCtx *ctx);
+
+bool sudoku_generate(struct SudokuCtx *ctx, char *gen_sudoku);
+bool sudoku_fill(struct SudokuCtx *ctx, char *grid);
+bool sudoku_solve(struct SudokuCtx *ctx, char *sudoku_to_solve);
+int sudoku_count_solutions(struct SudokuCtx *ctx, const char *sudoku_to_count);
+bool sudoku_count_exact(struct SudokuCtx *ctx, const char *sudoku, unsigned long long limit,
+                        struct SudokuCount *count);
+bool sudoku_check_validity(const struct SudokuCtx *ctx, const char *sudoku_to_check);
+int sudoku_find_conflicts(const struct SudokuCtx *ctx, const char *sudoku, bool *conflicts);
+int sudoku_parse(const char *text, size_t len, char *parsed);
+enum SudokuGrade sudoku_grade(const struct SudokuCtx *ctx, const char *sudoku);
+const char *sudoku_grade_name(enum SudokuGrade grade);
+const char *sudoku_variant_name(enum SudokuVariant variant);
+int sudoku_variant_region(enum SudokuVariant variant, int cell);
+bool sudoku_variant_marked(enum SudokuVariant variant, int cell);
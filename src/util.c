@@ -18,27 +18,29 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "util.h"
 
+#include "board.h"
+#include "history.h"
 #include "main.h"
-#include "ncurses_render.h"
+#include "probes.h"
+#include "render.h"
 #include "sudoku.h"
 
-#include <curses.h>
 #include <dirent.h>
 #include <errno.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-void fprintf_char_arr(const char *arr, size_t sz, FILE *out);
-void fprintf_int_arr(const int *arr, size_t sz, FILE *out);
 
 // Exit ncurses cleanly
 
 void finish(int sig)
 {
-    endwin();
+    finish_renderer();
     if (sig == SIGSEGV) {
         printf("Segfault\n");
         exit(1);
@@ -50,7 +52,7 @@ void finish(int sig)
 // application
 void finish_with_err_msg(const char *msg, ...)
 {
-    endwin();
+    finish_renderer();
 
     // Send '...'-args to vprintf
     va_list format;
@@ -62,7 +64,7 @@ void finish_with_err_msg(const char *msg, ...)
 }
 
 void finish_with_errno(const char *msg, ...) {
-    endwin();
+    finish_renderer();
 
     va_list format;
     va_start(format, msg);
@@ -121,36 +123,26 @@ void freefiles(char **files, int sz)
     free(files);
 }
 
-void fprintf_char_arr(const char *arr, size_t sz, FILE *out)
+// Write the puzzle, the numbers of the user, the notes and the undo history (if
+// not NULL) to file
+bool savestate(const char *filename, const struct SudokuSpec *spec, const struct History *history)
 {
-    for (size_t i = 0; i < sz; i++) {
-        fprintf(out, "%c", arr[i]);
-    }
-    fprintf(out, "\n");
-}
-
-void fprintf_int_arr(const int *arr, size_t sz, FILE *out)
-{
-    for (size_t i = 0; i < sz; i++) {
-        fprintf(out, "%d", arr[i]);
-    }
-    fprintf(out, "\n");
-}
+    PROBE1(term_sudoku, save__start, filename);
 
-// Write sudoku_str, user_nums and notes to file
-bool savestate(const char *filename, const struct SudokuSpec *spec)
-{
     FILE *savestate = fopen(filename, "w");
 
-    if (savestate == NULL)
+    if (savestate == NULL) {
+        PROBE1(term_sudoku, save__end, false);
         return false;
+    }
 
-    fprintf_char_arr(spec->sudoku, SUDOKU_LEN, savestate);
-    fprintf_char_arr(spec->user, SUDOKU_LEN, savestate);
-    fprintf_int_arr(spec->notes, SUDOKU_LEN * LINE_LEN, savestate);
+    board_write(spec, savestate);
+    if (history != NULL)
+        history_write(history, savestate);
 
     fclose(savestate);
 
+    PROBE1(term_sudoku, save__end, true);
     return true;
 }
 
@@ -180,10 +172,18 @@ bool status_bar_confirmation(struct TSStruct *spec)
     sprintf(spec->statusbar, "%s", "Sure? y/n");
     draw(spec);
 
-    char confirm = getch();
+    char confirm = get_key();
 
     sprintf(spec->statusbar, "%s", statusbar_backup);
     draw(spec);
 
     return confirm == 'y';
 }
+
+// Nanoseconds on the monotonic clock, for measuring intervals
+long long monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
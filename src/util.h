@@ -23,6 +23,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #define CHNUM(x) ((x) - 0x30)
 
+struct History;
 struct SudokuSpec;
 struct TSStruct;
 
@@ -32,5 +33,6 @@ void finish_with_errno(const char *msg, ...);
 void gen_file_name(char *filename, size_t sz, char *dir);
 char **listfiles(const char *dir_name, int *iterator);
 void freefiles(char **files, int sz);
-bool savestate(const char *filename, const struct SudokuSpec *spec);
+bool savestate(const char *filename, const struct SudokuSpec *spec, const struct History *history);
 bool status_bar_confirmation(struct TSStruct *spec);
+long long monotonic_ns(void);